@@ -1,6 +1,10 @@
 #include "sakura.hpp"
 #include <cpr/cpr.h>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
 #include <getopt.h>
+#include <iomanip>
 #include <iostream>
 #include <opencv2/opencv.hpp>
 #include <sys/ioctl.h>
@@ -44,6 +48,40 @@ std::pair<int, int> calculateBestFitSize(int contentWidth, int contentHeight,
   return {outw, outh};
 }
 
+// --stats / --stats-file: per-stage playback timings.
+struct StatsFlags {
+  bool print = false;
+  std::string file;
+
+  void apply(Sakura::RenderOptions &options) const {
+    options.collectStats = print || !file.empty();
+    options.statsFile = file;
+  }
+};
+
+void print_stats(const Sakura &sakura) {
+  const Sakura::PlaybackStats stats = sakura.stats();
+  std::cout << "\nStage timings (ms), " << stats.framesDisplayed
+            << " frames displayed, " << stats.framesDropped << " dropped\n"
+            << std::left << std::setw(8) << "stage" << std::right
+            << std::setw(9) << "count" << std::setw(9) << "mean"
+            << std::setw(9) << "p50" << std::setw(9) << "p95" << std::setw(9)
+            << "p99" << std::setw(9) << "max" << "\n"
+            << std::fixed << std::setprecision(2);
+  for (int i = 0; i < Sakura::STAGE_COUNT; ++i) {
+    const Sakura::StageStats &stage = stats.stages[i];
+    if (stage.count == 0)
+      continue;
+    std::cout << std::left << std::setw(8)
+              << Sakura::stageName(static_cast<Sakura::Stage>(i))
+              << std::right << std::setw(9) << stage.count << std::setw(9)
+              << stage.mean << std::setw(9) << stage.p50 << std::setw(9)
+              << stage.p95 << std::setw(9) << stage.p99 << std::setw(9)
+              << stage.max << "\n";
+  }
+  std::cout << std::flush;
+}
+
 bool process_image(std::string url) {
   Sakura sakura;
   bool stat = false;
@@ -76,7 +114,7 @@ bool process_image(std::string url) {
   return sakura.renderFromMat(img, options);
 }
 
-bool process_gif(std::string url) {
+bool process_gif(std::string url, const StatsFlags &stats = {}) {
   Sakura sakura;
   bool stat = false;
   auto [termPixW, termPixH] = getTerminalPixelSize();
@@ -88,11 +126,15 @@ bool process_gif(std::string url) {
   options.terminalAspectRatio = 1.0;
   options.width = termPixW;
   options.height = termPixH;
+  stats.apply(options);
 
-  return sakura.renderGifFromUrl(url, options);
+  stat = sakura.renderGifFromUrl(url, options);
+  if (stats.print)
+    print_stats(sakura);
+  return stat;
 }
 
-bool process_video(std::string url) {
+bool process_video(std::string url, const StatsFlags &stats = {}) {
   Sakura sakura;
   bool stat = false;
   auto [termPixW, termPixH] = getTerminalPixelSize();
@@ -104,13 +146,15 @@ bool process_video(std::string url) {
   options.terminalAspectRatio = 1.0;
   options.width = termPixW;
   options.height = termPixH;
+  stats.apply(options);
 
-  return sakura.renderVideoFromUrl(url, options);
+  stat = sakura.renderVideoFromUrl(url, options);
+  if (stats.print)
+    print_stats(sakura);
+  return stat;
 }
 
-bool process_local_video(std::string path) {
-  Sakura sakura;
-  bool stat = false;
+Sakura::RenderOptions local_video_options() {
   auto [termCols, termRows] = getTerminalCharSize(); // Use character dimensions
 
   // Ultra-fast settings for maximum performance
@@ -131,11 +175,75 @@ bool process_local_video(std::string path) {
   options.tileUpdates = false;
   options.fit = Sakura::FitMode::COVER; // Fill terminal
   options.sixelQuality = Sakura::SixelQuality::HIGH;
+  return options;
+}
+
+bool process_local_video(std::string path, const StatsFlags &stats = {}) {
+  Sakura sakura;
+  bool stat = false;
+  Sakura::RenderOptions options = local_video_options();
+  stats.apply(options);
 
   stat = sakura.renderVideoFromFile(path, options);
+  if (stats.print)
+    print_stats(sakura);
   return stat;
 }
 
+// Pre-renders a local video for the current terminal size.
+bool process_transcode(std::string path, std::string output) {
+  Sakura sakura;
+  if (output.empty()) {
+    output = path + ".sakura";
+  }
+  return sakura.transcodeVideo(path, output, local_video_options());
+}
+
+bool process_play(std::string path, int loops, const StatsFlags &stats = {}) {
+  Sakura sakura;
+  Sakura::RenderOptions options;
+  stats.apply(options);
+
+  const bool stat = sakura.playTranscoded(path, options, loops);
+  if (stats.print)
+    print_stats(sakura);
+  return stat;
+}
+
+// Renders a directory, or a file listing one path/URL per line, to SIXEL
+// files in `output`.
+bool process_batch(std::string input, std::string output, int threads) {
+  Sakura sakura;
+  std::vector<std::string> inputs;
+  std::ifstream list(input);
+  if (std::filesystem::is_directory(input) || !list) {
+    inputs.push_back(input);
+  } else {
+    for (std::string line; std::getline(list, line);) {
+      if (!line.empty())
+        inputs.push_back(line);
+    }
+  }
+
+  auto [termPixW, termPixH] = getTerminalPixelSize();
+  Sakura::RenderOptions options;
+  options.mode = Sakura::SIXEL;
+  options.terminalAspectRatio = 1.0;
+  options.width = termPixW;
+  options.height = termPixH;
+
+  const Sakura::BatchReport report = sakura.renderBatch(
+      inputs, output.empty() ? "." : output, options, threads);
+  for (const auto &[failed, reason] : report.failures) {
+    std::cerr << failed << ": " << reason << "\n";
+  }
+  std::cout << "Rendered " << report.rendered << " images in " << std::fixed
+            << std::setprecision(2) << report.seconds << " s ("
+            << report.imagesPerSecond << " images/s), "
+            << report.failures.size() << " failed\n";
+  return report.failures.empty();
+}
+
 int main(int argc, char **argv) {
   // Parse command line arguments
   static struct option long_options[] = {
@@ -144,17 +252,31 @@ int main(int argc, char **argv) {
       {"gif", required_argument, 0, 'g'},
       {"video", required_argument, 0, 'v'},
       {"local-video", required_argument, 0, 'l'},
+      {"stats", no_argument, 0, 's'},
+      {"stats-file", required_argument, 0, 'S'},
+      {"transcode", required_argument, 0, 't'},
+      {"output", required_argument, 0, 'o'},
+      {"play", required_argument, 0, 'p'},
+      {"loops", required_argument, 0, 'L'},
+      {"batch", required_argument, 0, 'b'},
+      {"threads", required_argument, 0, 'j'},
       {0, 0, 0, 0}};
 
   std::string video_path, image_path;
   bool show_help = false;
+  StatsFlags stats;
+  std::string output;
+  int loops = 1;
+  int threads = 0;
+  // Actions run after parsing so flags apply whatever their position.
+  std::vector<std::pair<int, std::string>> actions;
 
   int opt;
   int option_index = 0;
   bool stat = false;
 
   if (argc > 1) {
-    while ((opt = getopt_long(argc, argv, "hv:i:g:l:", long_options,
+    while ((opt = getopt_long(argc, argv, "hv:i:g:l:st:o:p:b:j:", long_options,
                               &option_index)) != -1) {
       switch (opt) {
       case 'h':
@@ -164,23 +286,52 @@ int main(int argc, char **argv) {
                   << "  -i, --image <path>         Process image file\n"
                   << "  -g, --gif <path>           Process GIF file\n"
                   << "  -v, --video <path>         Process video file\n"
-                  << "  -l, --local-video <path>   Process local video file\n";
+                  << "  -l, --local-video <path>   Process local video file\n"
+                  << "  -s, --stats                Print per-stage timings "
+                     "after playback\n"
+                  << "      --stats-file <path>    Append per-stage timings "
+                     "as JSON lines\n"
+                  << "  -t, --transcode <path>     Pre-render local video to "
+                     "a .sakura file\n"
+                  << "  -o, --output <path>        Transcode file (default "
+                     "<path>.sakura) or batch directory\n"
+                  << "  -p, --play <path>          Play a .sakura file\n"
+                  << "      --loops <n>            Times to play it, 0 = "
+                     "forever\n"
+                  << "  -b, --batch <dir|list>     Render images to SIXEL "
+                     "files in --output\n"
+                  << "  -j, --threads <n>          Batch workers (default: "
+                     "one per core)\n";
         return 0;
 
       case 'i':
-        stat = process_image(optarg);
+      case 'g':
+      case 'v':
+      case 'l':
+      case 't':
+      case 'p':
+      case 'b':
+        actions.emplace_back(opt, optarg);
         break;
 
-      case 'g':
-        stat = process_gif(optarg);
+      case 'o':
+        output = optarg;
         break;
 
-      case 'v':
-        stat = process_video(optarg);
+      case 'L':
+        loops = std::atoi(optarg);
         break;
 
-      case 'l':
-        stat = process_local_video(optarg);
+      case 'j':
+        threads = std::atoi(optarg);
+        break;
+
+      case 's':
+        stats.print = true;
+        break;
+
+      case 'S':
+        stats.file = optarg;
         break;
 
       case '?':
@@ -192,6 +343,31 @@ int main(int argc, char **argv) {
         return 1;
       }
     }
+    for (const auto &[action, target] : actions) {
+      switch (action) {
+      case 'i':
+        stat = process_image(target);
+        break;
+      case 'g':
+        stat = process_gif(target, stats);
+        break;
+      case 'v':
+        stat = process_video(target, stats);
+        break;
+      case 'l':
+        stat = process_local_video(target, stats);
+        break;
+      case 't':
+        stat = process_transcode(target, output);
+        break;
+      case 'p':
+        stat = process_play(target, loops, stats);
+        break;
+      case 'b':
+        stat = process_batch(target, output, threads);
+        break;
+      }
+    }
     if (!stat) {
       std::cerr << "Failed to render content\n";
     }
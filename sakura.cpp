@@ -1,25 +1,41 @@
 #include "sakura.hpp"
 #include <algorithm>
+#include <array>
 #include <atomic>
+#include <charconv>
+#include <cmath>
 #include <chrono>
 #include <condition_variable>
 #include <cpr/cpr.h>
+#include <cctype>
+#include <cerrno>
+#include <cstdint>
 #include <cstdio>
 #include <cstdlib>
+#include <cstring>
 #include <ctime>
 #include <deque>
+#include <filesystem>
 #include <fstream>
+#include <functional>
 #include <future>
 #include <iomanip>
 #include <iostream>
+#include <limits>
+#include <list>
 #include <map>
 #include <memory>
 #include <mutex>
+#include <numeric>
+#include <openssl/evp.h>
+#include <optional>
 #include <queue>
 #include <sixel.h>
 #include <sstream>
 #include <string_view>
 #include <thread>
+#include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
 const std::string Sakura::ASCII_CHARS_SIMPLE = " .:-=+*#%@";
@@ -28,6 +44,9 @@ const std::string Sakura::ASCII_CHARS_DETAILED =
 const std::string Sakura::ASCII_CHARS_BLOCKS = " \u2591\u2592\u2593\u2588";
 
 #ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#include <sys/stat.h>
 #include <windows.h>
 std::pair<int, int> Sakura::getTerminalSize() {
   CONSOLE_SCREEN_BUFFER_INFO csbi;
@@ -35,9 +54,19 @@ std::pair<int, int> Sakura::getTerminalSize() {
   return {csbi.srWindow.Right - csbi.srWindow.Left + 1,
           csbi.srWindow.Bottom - csbi.srWindow.Top + 1};
 }
+std::pair<int, int> Sakura::getTerminalCellSize() { return {10, 20}; }
 #else
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <spawn.h>
 #include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/wait.h>
 #include <unistd.h>
+extern char **environ;
 std::pair<int, int> Sakura::getTerminalSize() {
   struct winsize w;
   if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &w) == 0) {
@@ -45,17 +74,333 @@ std::pair<int, int> Sakura::getTerminalSize() {
   }
   return {80, 24};
 }
+std::pair<int, int> Sakura::getTerminalCellSize() {
+  struct winsize w;
+  if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &w) == 0 && w.ws_col > 0 &&
+      w.ws_row > 0 && w.ws_xpixel > 0 && w.ws_ypixel > 0) {
+    return {std::max(1, w.ws_xpixel / w.ws_col),
+            std::max(1, w.ws_ypixel / w.ws_row)};
+  }
+  return {10, 20};
+}
+#endif
+
+namespace {
+// Latency histogram with logarithmic buckets: every power of two of
+// nanoseconds is split into eight, so reported percentiles are within about
+// 6% of the true value. Recording is a few relaxed atomic operations, safe
+// from the decoder, worker and writer threads at once.
+class LatencyHistogram {
+public:
+  void record(std::chrono::steady_clock::duration elapsed) noexcept {
+    const auto ns = static_cast<std::uint64_t>(std::max<long long>(
+        0, std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed)
+               .count()));
+    buckets_[bucketOf(ns)].fetch_add(1, std::memory_order_relaxed);
+    count_.fetch_add(1, std::memory_order_relaxed);
+    total_ns_.fetch_add(ns, std::memory_order_relaxed);
+    std::uint64_t max = max_ns_.load(std::memory_order_relaxed);
+    while (ns > max && !max_ns_.compare_exchange_weak(
+                           max, ns, std::memory_order_relaxed)) {
+    }
+  }
+
+  void reset() noexcept {
+    for (auto &bucket : buckets_)
+      bucket.store(0, std::memory_order_relaxed);
+    count_.store(0, std::memory_order_relaxed);
+    total_ns_.store(0, std::memory_order_relaxed);
+    max_ns_.store(0, std::memory_order_relaxed);
+  }
+
+  Sakura::StageStats snapshot() const {
+    std::array<std::uint64_t, BUCKETS> counts;
+    std::uint64_t count = 0;
+    for (int i = 0; i < BUCKETS; ++i) {
+      counts[i] = buckets_[i].load(std::memory_order_relaxed);
+      count += counts[i];
+    }
+    Sakura::StageStats stats;
+    if (count == 0)
+      return stats;
+    constexpr double MS = 1e-6;
+    stats.count = static_cast<long long>(count);
+    stats.mean = MS * total_ns_.load(std::memory_order_relaxed) / count;
+    stats.max = MS * max_ns_.load(std::memory_order_relaxed);
+    const auto percentile = [&](double p) {
+      const auto rank = static_cast<std::uint64_t>(std::ceil(p * count));
+      std::uint64_t seen = 0;
+      for (int i = 0; i < BUCKETS; ++i) {
+        seen += counts[i];
+        if (seen >= rank)
+          return std::min(MS * bucketMiddle(i), stats.max);
+      }
+      return stats.max;
+    };
+    stats.p50 = percentile(0.50);
+    stats.p95 = percentile(0.95);
+    stats.p99 = percentile(0.99);
+    return stats;
+  }
+
+private:
+  static constexpr int SUB_BITS = 3;
+  static constexpr int SUB_BUCKETS = 1 << SUB_BITS;
+  static constexpr int BUCKETS = (64 - SUB_BITS + 1) * SUB_BUCKETS;
+
+  static int highestBit(std::uint64_t v) noexcept {
+#if defined(__GNUC__) || defined(__clang__)
+    return 63 - __builtin_clzll(v);
+#else
+    int bit = 0;
+    while (v >>= 1)
+      ++bit;
+    return bit;
 #endif
+  }
+
+  // Values below 8 ns get a bucket each; above, the highest bit picks the
+  // octave and the next three bits the bucket within it.
+  static int bucketOf(std::uint64_t ns) noexcept {
+    if (ns < SUB_BUCKETS)
+      return static_cast<int>(ns);
+    const int bit = highestBit(ns);
+    const int sub = static_cast<int>((ns >> (bit - SUB_BITS)) & (SUB_BUCKETS - 1));
+    return ((bit - SUB_BITS + 1) << SUB_BITS) | sub;
+  }
+
+  static double bucketMiddle(int bucket) noexcept {
+    if (bucket < SUB_BUCKETS)
+      return bucket;
+    const int bit = (bucket >> SUB_BITS) + SUB_BITS - 1;
+    const double width = std::ldexp(1.0, bit - SUB_BITS);
+    const double low = (SUB_BUCKETS | (bucket & (SUB_BUCKETS - 1))) * width;
+    return low + width / 2;
+  }
+
+  std::array<std::atomic<std::uint64_t>, BUCKETS> buckets_{};
+  std::atomic<std::uint64_t> count_{0};
+  std::atomic<std::uint64_t> total_ns_{0};
+  std::atomic<std::uint64_t> max_ns_{0};
+};
+
+constexpr const char *STAGE_NAMES[Sakura::STAGE_COUNT] = {
+    "decode", "adjust", "resize", "encode", "write", "slack"};
+} // namespace
+
+// Stage histograms and frame counters behind Sakura::stats(). Playback with
+// collectStats resets them when it starts; with a statsFile, a reporter
+// thread appends a JSON snapshot every statsInterval until it stops.
+struct Sakura::Telemetry {
+  std::array<LatencyHistogram, STAGE_COUNT> stages;
+  std::atomic<long long> displayed{0};
+  std::atomic<long long> dropped{0};
+
+  std::mutex reporter_mutex;
+  std::condition_variable reporter_wake;
+  bool reporter_stop = false;
+  std::thread reporter;
+
+  ~Telemetry() { stopReporter(); }
+
+  void record(Stage stage, std::chrono::steady_clock::duration elapsed) {
+    stages[stage].record(elapsed);
+  }
+
+  void reset() {
+    for (auto &stage : stages)
+      stage.reset();
+    displayed = 0;
+    dropped = 0;
+  }
+
+  PlaybackStats snapshot() const {
+    PlaybackStats stats;
+    for (int i = 0; i < STAGE_COUNT; ++i)
+      stats.stages[i] = stages[i].snapshot();
+    stats.framesDisplayed = displayed.load();
+    stats.framesDropped = dropped.load();
+    return stats;
+  }
+
+  void startReporter(const std::string &path, double interval_seconds) {
+    stopReporter();
+    if (path.empty())
+      return;
+    const auto interval = std::chrono::duration_cast<
+        std::chrono::steady_clock::duration>(
+        std::chrono::duration<double>(std::max(interval_seconds, 0.01)));
+    reporter_stop = false;
+    reporter = std::thread([this, path, interval] {
+      std::ofstream file(path, std::ios::app);
+      if (!file) {
+        std::cerr << "Failed to open stats file: " << path << std::endl;
+        return;
+      }
+      const auto start = std::chrono::steady_clock::now();
+      std::unique_lock<std::mutex> lock(reporter_mutex);
+      for (bool last = false; !last;) {
+        last = reporter_wake.wait_for(lock, interval,
+                                      [this] { return reporter_stop; });
+        writeJsonLine(file, std::chrono::duration<double>(
+                                std::chrono::steady_clock::now() - start)
+                                .count());
+      }
+    });
+  }
+
+  // Writes a final line and joins the reporter.
+  void stopReporter() {
+    if (!reporter.joinable())
+      return;
+    {
+      std::lock_guard<std::mutex> lock(reporter_mutex);
+      reporter_stop = true;
+    }
+    reporter_wake.notify_all();
+    reporter.join();
+  }
+
+  void writeJsonLine(std::ostream &out, double elapsed) const {
+    const PlaybackStats stats = snapshot();
+    out << std::fixed << std::setprecision(3) << "{\"elapsed\":" << elapsed
+        << ",\"displayed\":" << stats.framesDisplayed
+        << ",\"dropped\":" << stats.framesDropped << ",\"stages\":{";
+    for (int i = 0; i < STAGE_COUNT; ++i) {
+      const StageStats &stage = stats.stages[i];
+      out << (i > 0 ? "," : "") << '"' << STAGE_NAMES[i]
+          << "\":{\"count\":" << stage.count << ",\"mean_ms\":" << stage.mean
+          << ",\"p50_ms\":" << stage.p50 << ",\"p95_ms\":" << stage.p95
+          << ",\"p99_ms\":" << stage.p99 << ",\"max_ms\":" << stage.max
+          << '}';
+    }
+    out << "}}" << std::endl;
+  }
+};
+
+Sakura::Sakura() : telemetry_(std::make_shared<Telemetry>()) {}
+
+Sakura::PlaybackStats Sakura::stats() const { return telemetry_->snapshot(); }
+
+const char *Sakura::stageName(Stage stage) noexcept {
+  return stage >= 0 && stage < STAGE_COUNT ? STAGE_NAMES[stage] : "unknown";
+}
+
+namespace {
+// Contrast and brightness as a 256-entry table, applied after downscaling;
+// empty when pixels are left as they are. contrast 1.0 turns the adjustment
+// off and any other value is scaled by 1.2, as the convertTo call this
+// replaced did, so existing settings render the same.
+cv::Mat colourAdjustLut(double contrast, double brightness) {
+  if (contrast == 1.0 && brightness == 0.0)
+    return {};
+  const double alpha = contrast * 1.2;
+  cv::Mat lut(1, 256, CV_8U);
+  for (int i = 0; i < 256; ++i)
+    lut.at<uchar>(i) = cv::saturate_cast<uchar>(i * alpha + brightness);
+  return lut;
+}
+
+// Half-block renderers draw two pixel rows per cell.
+int rowsPerCell(Sakura::RenderMode mode) {
+  return mode == Sakura::EXACT || mode == Sakura::ULTRA_FAST ? 2 : 1;
+}
+
+// Where a source lands in a width x height box of cells (pixels for SIXEL).
+struct FitGeometry {
+  cv::Rect source; // region of the source that is shown
+  int width = 0;   // output size in cells
+  int height = 0;
+};
+
+// Aspects are compared on the renderer's pixel grid, with each output pixel
+// displayed terminalAspectRatio wide for one tall. CONTAIN shrinks the box to
+// the source aspect, COVER keeps the box and crops the middle of the source,
+// STRETCH takes both as they are; aspectRatio = false always stretches.
+FitGeometry fitGeometry(cv::Size source, int width, int height,
+                        const Sakura::RenderOptions &options) {
+  FitGeometry fit{cv::Rect(cv::Point(), source), std::max(width, 1),
+                  std::max(height, 1)};
+  const Sakura::FitMode mode = options.aspectRatio ? options.fit
+                                                   : Sakura::STRETCH;
+  if (mode == Sakura::STRETCH || source.area() <= 0)
+    return fit;
+
+  const int rows = rowsPerCell(options.mode);
+  const double pixel_aspect =
+      options.terminalAspectRatio > 0.0 ? options.terminalAspectRatio : 1.0;
+  const double source_aspect =
+      static_cast<double>(source.width) / source.height / pixel_aspect;
+  const double box_aspect = static_cast<double>(fit.width) / (fit.height * rows);
+
+  if (mode == Sakura::CONTAIN) {
+    if (source_aspect > box_aspect) {
+      fit.height = static_cast<int>(
+          std::lround(fit.width / source_aspect / rows));
+    } else {
+      fit.width = static_cast<int>(
+          std::lround(fit.height * rows * source_aspect));
+    }
+    fit.width = std::max(fit.width, 1);
+    fit.height = std::max(fit.height, 1);
+  } else if (source_aspect > box_aspect) {
+    const int cols = std::max(1, static_cast<int>(std::lround(
+                                     source.width * box_aspect / source_aspect)));
+    fit.source = cv::Rect((source.width - cols) / 2, 0, cols, source.height);
+  } else {
+    const int kept = std::max(1, static_cast<int>(std::lround(
+                                     source.height * source_aspect / box_aspect)));
+    fit.source = cv::Rect(0, (source.height - kept) / 2, source.width, kept);
+  }
+  return fit;
+}
+} // namespace
+
+// Downscales first and adjusts colour on the small result. Large INTER_AREA
+// reductions first shrink by the biggest integer factor that leaves at least
+// twice the output size, an exact multiple that takes OpenCV's box-filter
+// fast path, so the general area resampler only sees a small image.
+void Sakura::scaleAndAdjust(const cv::Mat &img, cv::Size size,
+                            int interpolation, const cv::Mat &lut,
+                            cv::Mat &dst, cv::Mat &scratch,
+                            Telemetry *telemetry) const {
+  const auto resize_start = std::chrono::steady_clock::now();
+  cv::Mat source = img;
+  if (interpolation == cv::INTER_AREA) {
+    const int factor =
+        std::min(img.cols / (2 * size.width), img.rows / (2 * size.height));
+    if (factor >= 2) {
+      const cv::Size reduced(img.cols / factor, img.rows / factor);
+      const cv::Rect exact((img.cols - reduced.width * factor) / 2,
+                           (img.rows - reduced.height * factor) / 2,
+                           reduced.width * factor, reduced.height * factor);
+      cv::resize(img(exact), scratch, reduced, 0, 0, cv::INTER_AREA);
+      source = scratch;
+    }
+  }
+  if (source.size() != size) {
+    cv::resize(source, dst, size, 0, 0, interpolation);
+    source = dst;
+  } else if (lut.empty()) {
+    dst = source;
+  } else if (dst.data == source.data) {
+    dst = cv::Mat(); // never adjust the caller's pixels in place
+  }
+  const auto adjust_start = std::chrono::steady_clock::now();
+  if (telemetry)
+    telemetry->record(RESIZE, adjust_start - resize_start);
+  if (lut.empty())
+    return;
+  cv::LUT(source, lut, dst);
+  if (telemetry)
+    telemetry->record(ADJUST, std::chrono::steady_clock::now() - adjust_start);
+}
 
 bool Sakura::preprocessAndResize(const cv::Mat &img,
                                  const RenderOptions &options, cv::Mat &resized,
                                  int &target_width, int &target_height) const {
-  cv::Mat adjusted;
-  if (options.contrast != 1.0 || options.brightness != 0.0) {
-    img.convertTo(adjusted, -1, options.contrast * 1.2, options.brightness);
-  } else {
-    adjusted = img;
-  }
+  if (img.empty())
+    return false;
 
   target_width = options.width;
   target_height = options.height;
@@ -68,32 +413,633 @@ bool Sakura::preprocessAndResize(const cv::Mat &img,
       target_height = h;
   }
 
-  if (options.aspectRatio) {
-    double aspectRatio = static_cast<double>(adjusted.cols) / adjusted.rows;
-    if (options.mode == EXACT || options.mode == ASCII_COLOR ||
-        options.mode == SIXEL) {
-      aspectRatio /= options.terminalAspectRatio;
+  const FitGeometry fit =
+      fitGeometry(img.size(), target_width, target_height, options);
+  target_width = fit.width;
+  target_height = fit.height;
+  const cv::Size targetSize(target_width,
+                            target_height * rowsPerCell(options.mode));
+
+  cv::Mat scratch;
+  scaleAndAdjust(img(fit.source), targetSize, cv::INTER_AREA,
+                 colourAdjustLut(options.contrast, options.brightness),
+                 resized, scratch,
+                 options.collectStats ? telemetry_.get() : nullptr);
+  return !resized.empty();
+}
+
+namespace {
+std::string sha256Hex(std::string_view data) {
+  unsigned char digest[EVP_MAX_MD_SIZE];
+  unsigned int length = 0;
+  EVP_Digest(data.data(), data.size(), digest, &length, EVP_sha256(),
+             nullptr);
+  static constexpr char HEX[] = "0123456789abcdef";
+  std::string hex(2 * length, '0');
+  for (unsigned int i = 0; i < length; ++i) {
+    hex[2 * i] = HEX[digest[i] >> 4];
+    hex[2 * i + 1] = HEX[digest[i] & 0xf];
+  }
+  return hex;
+}
+
+// Everything in RenderOptions that changes the rendered output, with the
+// target size already resolved against the terminal.
+std::string outputKey(const Sakura::RenderOptions &options, int width,
+                      int height) {
+  std::ostringstream key;
+  key << "v2 " << width << 'x' << height << " mode=" << options.mode
+      << " style=" << options.style << " dither=" << options.dither
+      << " palette=" << options.paletteSize << " aspect=" << options.aspectRatio
+      << " contrast=" << options.contrast
+      << " brightness=" << options.brightness
+      << " cell=" << options.terminalAspectRatio << " fit=" << options.fit
+      << " sixel=" << options.sixelQuality << '/' << options.sixelEncoder
+      << '/' << options.quantizer;
+  return key.str();
+}
+
+std::string headerValue(const cpr::Header &header, const std::string &name) {
+  const auto it = header.find(name);
+  return it != header.end() ? it->second : std::string();
+}
+
+bool readFile(const std::filesystem::path &path, std::string &contents) {
+  std::ifstream file(path, std::ios::binary | std::ios::ate);
+  if (!file)
+    return false;
+  contents.resize(static_cast<std::size_t>(file.tellg()));
+  file.seekg(0);
+  file.read(contents.data(), static_cast<std::streamsize>(contents.size()));
+  return static_cast<bool>(file);
+}
+
+// Creates an empty file named `prefix` plus a suffix that is unique across
+// threads and processes, and returns its path; empty on failure.
+std::string createUniqueFile(const std::string &prefix) {
+#ifdef _WIN32
+  static std::atomic<unsigned> counter{0};
+  for (int attempt = 0; attempt < 100; ++attempt) {
+    const std::string path = prefix +
+                             std::to_string(GetCurrentProcessId()) + "-" +
+                             std::to_string(counter++);
+    const int fd = _open(path.c_str(), _O_CREAT | _O_EXCL | _O_WRONLY,
+                         _S_IREAD | _S_IWRITE);
+    if (fd >= 0) {
+      _close(fd);
+      return path;
+    }
+    if (errno != EEXIST)
+      break;
+  }
+  return {};
+#else
+  std::string path = prefix + "XXXXXX";
+  const int fd = mkstemp(path.data());
+  if (fd < 0)
+    return {};
+  close(fd);
+  return path;
+#endif
+}
+
+// Written under a unique temporary name and renamed into place, so readers
+// in other threads or processes never see a partial file.
+bool writeFileAtomic(const std::filesystem::path &path,
+                     std::string_view contents) {
+  const std::string temp = createUniqueFile(path.string() + ".tmp");
+  if (temp.empty())
+    return false;
+  {
+    std::ofstream file(temp, std::ios::binary | std::ios::trunc);
+    file.write(contents.data(), static_cast<std::streamsize>(contents.size()));
+    if (!file) {
+      std::error_code ignored;
+      std::filesystem::remove(temp, ignored);
+      return false;
+    }
+  }
+  std::error_code error;
+  std::filesystem::rename(temp, path, error);
+  if (error) {
+    std::filesystem::remove(temp, error);
+    return false;
+  }
+  return true;
+}
+} // namespace
+
+struct Sakura::RenderCache::State {
+  // What the server last said about a URL. Persisted next to the rendered
+  // output so a new process can still revalidate instead of downloading.
+  struct Validators {
+    std::string etag;
+    std::string last_modified;
+    std::string content_hash;
+    std::chrono::steady_clock::time_point checked;
+  };
+
+  // A decoded image, or for memory-only caches a rendered output.
+  struct CachedEntry {
+    cv::Mat image;
+    std::string output;
+    std::size_t bytes = 0;
+    std::list<std::string>::iterator position;
+  };
+
+  std::size_t memory_budget;
+  std::filesystem::path directory;
+  std::chrono::seconds revalidate_after;
+
+  std::mutex mutex;
+  std::unordered_map<std::string, Validators> validators; // by URL
+  // Images by content hash, outputs by output hash; one LRU for both.
+  std::unordered_map<std::string, CachedEntry> entries;
+  std::list<std::string> recency; // most recent first
+  std::size_t cached_bytes = 0;
+
+  std::filesystem::path validatorPath(std::string_view url) const {
+    return directory / (sha256Hex(url) + ".url");
+  }
+
+  std::optional<Validators> findValidators(std::string_view url) {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      const auto it = validators.find(std::string(url));
+      if (it != validators.end())
+        return it->second;
+    }
+    std::string contents;
+    if (directory.empty() || !readFile(validatorPath(url), contents))
+      return std::nullopt;
+    // Loaded from disk: unknown age, so always revalidated first.
+    Validators loaded;
+    std::istringstream lines(contents);
+    std::getline(lines, loaded.content_hash);
+    std::getline(lines, loaded.etag);
+    std::getline(lines, loaded.last_modified);
+    if (loaded.content_hash.empty())
+      return std::nullopt;
+    return loaded;
+  }
+
+  void storeValidators(std::string_view url, const Validators &entry) {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      validators[std::string(url)] = entry;
+    }
+    if (!directory.empty()) {
+      writeFileAtomic(validatorPath(url), entry.content_hash + '\n' +
+                                              entry.etag + '\n' +
+                                              entry.last_modified + '\n');
+    }
+  }
+
+  cv::Mat findImage(const std::string &content_hash) {
+    std::lock_guard<std::mutex> lock(mutex);
+    const CachedEntry *entry = touch(content_hash);
+    return entry ? entry->image : cv::Mat();
+  }
+
+  bool findOutput(const std::string &output_hash, std::string &output) {
+    std::lock_guard<std::mutex> lock(mutex);
+    const CachedEntry *entry = touch(output_hash);
+    if (entry == nullptr)
+      return false;
+    output = entry->output;
+    return true;
+  }
+
+  void storeImage(const std::string &content_hash, const cv::Mat &image) {
+    CachedEntry entry;
+    entry.image = image;
+    entry.bytes = image.total() * image.elemSize();
+    store(content_hash, std::move(entry));
+  }
+
+  void storeOutput(const std::string &output_hash, const std::string &output) {
+    CachedEntry entry;
+    entry.output = output;
+    entry.bytes = output.size();
+    store(output_hash, std::move(entry));
+  }
+
+private:
+  // Both expect the mutex to be held.
+  const CachedEntry *touch(const std::string &id) {
+    const auto it = entries.find(id);
+    if (it == entries.end())
+      return nullptr;
+    recency.splice(recency.begin(), recency, it->second.position);
+    return &it->second;
+  }
+
+  void store(const std::string &id, CachedEntry entry) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (entry.bytes > memory_budget || entries.count(id) != 0)
+      return;
+    while (cached_bytes + entry.bytes > memory_budget) {
+      const auto victim = entries.find(recency.back());
+      cached_bytes -= victim->second.bytes;
+      entries.erase(victim);
+      recency.pop_back();
     }
+    recency.push_front(id);
+    entry.position = recency.begin();
+    cached_bytes += entry.bytes;
+    entries.emplace(id, std::move(entry));
+  }
+};
 
-    if (aspectRatio > static_cast<double>(target_width) / target_height) {
-      target_height = static_cast<int>(target_width / aspectRatio);
+Sakura::RenderCache::RenderCache(std::size_t memoryBudget,
+                                 std::string directory, int revalidateSeconds)
+    : state_(std::make_unique<State>()) {
+  state_->memory_budget = memoryBudget;
+  state_->revalidate_after =
+      std::chrono::seconds(std::max(0, revalidateSeconds));
+  if (!directory.empty()) {
+    std::error_code error;
+    std::filesystem::create_directories(directory, error);
+    if (error) {
+      std::cerr << "Render cache directory unavailable, using memory only: "
+                << directory << std::endl;
     } else {
-      target_width = static_cast<int>(target_height * aspectRatio);
+      state_->directory = directory;
     }
-    target_width = std::max(target_width, 1);
-    target_height = std::max(target_height, 1);
   }
+}
 
-  const cv::Size targetSize = (options.mode == EXACT)
-                                  ? cv::Size(target_width, target_height * 2)
-                                  : cv::Size(target_width, target_height);
+Sakura::RenderCache::~RenderCache() = default;
 
-  cv::resize(adjusted, resized, targetSize, 0, 0, cv::INTER_AREA);
-  return !resized.empty();
+bool Sakura::RenderCache::fetch(std::string_view url, const std::string &key,
+                                 const Renderer &render, std::string &output) {
+  State &state = *state_;
+  const auto now = std::chrono::steady_clock::now();
+  std::optional<State::Validators> known = state.findValidators(url);
+  std::string body;
+
+  // Conditional when validators are known. A 304 only refreshes them; a 200
+  // replaces them along with the body. Returns the HTTP status.
+  const auto download = [&](bool conditional) {
+    cpr::Header request;
+    if (conditional && !known->etag.empty())
+      request["If-None-Match"] = known->etag;
+    if (conditional && !known->last_modified.empty())
+      request["If-Modified-Since"] = known->last_modified;
+    auto response = cpr::Get(cpr::Url{std::string(url)}, request);
+    if (conditional && response.status_code == 304) {
+      known->checked = now;
+      state.storeValidators(url, *known);
+    } else if (response.status_code == 200) {
+      State::Validators fresh;
+      fresh.content_hash = sha256Hex(response.text);
+      fresh.etag = headerValue(response.header, "ETag");
+      fresh.last_modified = headerValue(response.header, "Last-Modified");
+      fresh.checked = now;
+      state.storeValidators(url, fresh);
+      known = std::move(fresh);
+      body = std::move(response.text);
+    }
+    return response.status_code;
+  };
+  // Rendered output lives on disk when there is a directory, otherwise in
+  // the memory LRU beside the images.
+  const auto output_hash = [&] {
+    return sha256Hex(known->content_hash + '\n' + key);
+  };
+  const auto read_output = [&] {
+    if (state.directory.empty())
+      return state.findOutput(output_hash(), output);
+    return readFile(state.directory / output_hash(), output);
+  };
+
+  // The server is asked at most once per revalidation interval.
+  const bool fresh =
+      known && known->checked != std::chrono::steady_clock::time_point() &&
+      now - known->checked < state.revalidate_after;
+  if (!fresh) {
+    const long status = download(known.has_value());
+    if (status != 200 && status != 304)
+      return false;
+  }
+  if (read_output())
+    return true;
+
+  cv::Mat image = state.findImage(known->content_hash);
+  if (image.empty() && body.empty()) {
+    // Unchanged on the server but evicted here: fetch the body after all,
+    // which may turn out to be new content with output already on disk.
+    if (download(false) != 200)
+      return false;
+    if (read_output())
+      return true;
+    image = state.findImage(known->content_hash);
+  }
+  if (image.empty()) {
+    const std::vector<uchar> imgData(body.begin(), body.end());
+    image = cv::imdecode(imgData, cv::IMREAD_COLOR);
+    if (image.empty())
+      return false;
+    state.storeImage(known->content_hash, image);
+  }
+
+  if (!render(image, output))
+    return false;
+  if (state.directory.empty()) {
+    state.storeOutput(output_hash(), output);
+  } else {
+    writeFileAtomic(state.directory / output_hash(), output);
+  }
+  return true;
+}
+
+namespace {
+// DEC private mode 2026: terminals that support it hold the screen between
+// the markers and show the frame at once; others ignore them.
+constexpr std::string_view SYNC_BEGIN = "\033[?2026h";
+constexpr std::string_view SYNC_END = "\033[?2026l";
+
+// Writes every part to fd in order, as one writev where the descriptor takes
+// it all, resuming after partial writes, interrupts and a full pipe.
+bool writeAll(int fd, std::initializer_list<std::string_view> parts) {
+#ifdef _WIN32
+  for (std::string_view part : parts) {
+    while (!part.empty()) {
+      const int chunk = static_cast<int>(
+          std::min<std::size_t>(part.size(), 1 << 30));
+      const int written = ::_write(fd, part.data(), chunk);
+      if (written <= 0)
+        return false;
+      part.remove_prefix(static_cast<std::size_t>(written));
+    }
+  }
+  return true;
+#else
+  std::array<iovec, 4> iov;
+  std::size_t count = 0;
+  for (const std::string_view part : parts) {
+    if (part.empty())
+      continue;
+    iov[count].iov_base = const_cast<char *>(part.data());
+    iov[count].iov_len = part.size();
+    ++count;
+  }
+  for (std::size_t first = 0; first < count;) {
+    const ssize_t written =
+        ::writev(fd, iov.data() + first, static_cast<int>(count - first));
+    if (written < 0) {
+      if (errno == EINTR)
+        continue;
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        pollfd out{fd, POLLOUT, 0};
+        ::poll(&out, 1, -1);
+        continue;
+      }
+      return false;
+    }
+    auto remaining = static_cast<std::size_t>(written);
+    while (first < count && remaining >= iov[first].iov_len) {
+      remaining -= iov[first].iov_len;
+      ++first;
+    }
+    if (first < count) {
+      iov[first].iov_base = static_cast<char *>(iov[first].iov_base) + remaining;
+      iov[first].iov_len -= remaining;
+    }
+  }
+  return true;
+#endif
+}
+
+constexpr Sakura::FrameInfo CONTROL_WRITE{0, 0.0, false, true};
+
+// options.sink, or stdout when none is set.
+std::shared_ptr<Sakura::OutputSink>
+outputSink(const Sakura::RenderOptions &options) {
+  if (options.sink)
+    return options.sink;
+  return std::make_shared<Sakura::FdSink>(1, options.synchronizedUpdates);
+}
+
+// Where playback status lines go: stdout alongside the frames, or stderr
+// when frames go to a custom sink whose stdout they would corrupt.
+std::ostream &statusStream(const Sakura::RenderOptions &options) {
+  return options.sink ? std::cerr : std::cout;
+}
+
+// Hands playback frames to the sink from its own thread so encoding the
+// next frame overlaps writing this one. At most `buffers` frames are
+// written or queued at once; submit() waits beyond that, and the time spent
+// in the sink is handed back to the player through takeWriteTime() so it
+// can shed quality when output is the bottleneck. Written buffers are
+// recycled through acquire().
+class TerminalWriter {
+public:
+  using WriteCallback = std::function<void(std::chrono::nanoseconds)>;
+
+  TerminalWriter(Sakura::OutputSink &sink, int buffers,
+                 WriteCallback on_write = {})
+      : sink_(sink),
+        buffers_(static_cast<std::size_t>(std::clamp(buffers, 1, 3))),
+        on_write_(std::move(on_write)) {
+    thread_ = std::thread([this] { run(); });
+  }
+
+  ~TerminalWriter() { close(); }
+
+  std::string acquire() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (free_.empty())
+      return {};
+    std::string buffer = std::move(free_.back());
+    free_.pop_back();
+    buffer.clear();
+    return buffer;
+  }
+
+  void recycle(std::string buffer) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    free_.push_back(std::move(buffer));
+  }
+
+  void submit(std::string frame, const Sakura::FrameInfo &info) {
+    enqueue({std::move(frame), std::nullopt, info});
+  }
+
+  // Queues bytes the caller owns, with no copy. They must stay alive and
+  // unchanged until close().
+  void submitBorrowed(std::string_view frame, const Sakura::FrameInfo &info) {
+    enqueue({std::string(), frame, info});
+  }
+
+  // Writes what is queued and stops the thread.
+  void close() {
+    if (!thread_.joinable())
+      return;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      closed_ = true;
+    }
+    ready_.notify_all();
+    thread_.join();
+  }
+
+  // False once the sink refused a frame.
+  bool ok() const noexcept { return !failed_.load(); }
+
+  std::chrono::nanoseconds takeWriteTime() noexcept {
+    return std::chrono::nanoseconds(write_ns_.exchange(0));
+  }
+
+private:
+  struct Pending {
+    std::string frame;
+    std::optional<std::string_view> borrowed; // written instead of `frame`
+    Sakura::FrameInfo info;
+  };
+
+  void enqueue(Pending pending) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    space_.wait(lock, [this] { return queue_.size() + busy_ < buffers_; });
+    queue_.push_back(std::move(pending));
+    lock.unlock();
+    ready_.notify_one();
+  }
+
+  void run() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true) {
+      ready_.wait(lock, [this] { return closed_ || !queue_.empty(); });
+      if (queue_.empty())
+        break;
+      Pending pending = std::move(queue_.front());
+      queue_.pop_front();
+      busy_ = 1;
+      lock.unlock();
+
+      const auto start = std::chrono::steady_clock::now();
+      // After a failure keep draining so the player never blocks.
+      const std::string_view bytes =
+          pending.borrowed ? *pending.borrowed : pending.frame;
+      if (!failed_ && !sink_.write(bytes, pending.info))
+        failed_ = true;
+      const auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(
+          std::chrono::steady_clock::now() - start);
+      write_ns_ += elapsed.count();
+      if (on_write_)
+        on_write_(elapsed);
+
+      lock.lock();
+      busy_ = 0;
+      if (!pending.borrowed)
+        free_.push_back(std::move(pending.frame));
+      space_.notify_one();
+    }
+  }
+
+  Sakura::OutputSink &sink_;
+  const std::size_t buffers_;
+  const WriteCallback on_write_;
+
+  std::mutex mutex_;
+  std::condition_variable ready_;
+  std::condition_variable space_;
+  std::deque<Pending> queue_;
+  std::vector<std::string> free_;
+  std::size_t busy_ = 0;
+  bool closed_ = false;
+  std::atomic<bool> failed_{false};
+  std::atomic<long long> write_ns_{0};
+  std::thread thread_;
+};
+} // namespace
+
+Sakura::FdSink::FdSink(int fd, bool synchronizedUpdates)
+    : fd_(fd), synchronized_(synchronizedUpdates) {}
+
+bool Sakura::FdSink::write(std::string_view bytes, const FrameInfo &info) {
+  if (fd_ == 1)
+    std::cout.flush(); // keep earlier status lines in order
+  const bool ok = synchronized_ && !info.control
+                      ? writeAll(fd_, {SYNC_BEGIN, bytes, SYNC_END})
+                      : writeAll(fd_, {bytes});
+  if (!ok)
+    std::cerr << "Output write failed: " << std::strerror(errno) << std::endl;
+  return ok;
+}
+
+bool Sakura::BufferSink::write(std::string_view bytes, const FrameInfo &info) {
+  buffer_ += bytes;
+  frames_ += info.control ? 0 : 1;
+  return true;
+}
+
+Sakura::RingSink::RingSink(std::size_t capacity)
+    : slots_(std::max<std::size_t>(capacity, 1)) {}
+
+bool Sakura::RingSink::write(std::string_view bytes, const FrameInfo &info) {
+  if (info.control)
+    return true;
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (size_ == slots_.size()) {
+    head_ = (head_ + 1) % slots_.size();
+    --size_;
+    ++overwritten_;
+  }
+  Slot &slot = slots_[(head_ + size_) % slots_.size()];
+  slot.bytes.assign(bytes.data(), bytes.size());
+  slot.info = info;
+  ++size_;
+  return true;
+}
+
+bool Sakura::RingSink::pop(std::string &frame, FrameInfo &info) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (size_ == 0)
+    return false;
+  Slot &slot = slots_[head_];
+  frame.swap(slot.bytes);
+  info = slot.info;
+  head_ = (head_ + 1) % slots_.size();
+  --size_;
+  return true;
+}
+
+long long Sakura::RingSink::overwritten() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return overwritten_;
 }
 
+Sakura::CallbackSink::CallbackSink(Callback callback)
+    : callback_(std::move(callback)) {}
+
+bool Sakura::CallbackSink::write(std::string_view bytes,
+                                 const FrameInfo &info) {
+  return callback_ ? callback_(bytes, info) : true;
+}
+
+
 bool Sakura::renderFromUrl(std::string_view url,
                            const RenderOptions &options) const {
+  if (options.cache) {
+    auto [width, height] = getTerminalSize();
+    if (options.width > 0)
+      width = options.width;
+    if (options.height > 0)
+      height = options.height;
+    std::string frame;
+    if (!options.cache->fetch(
+            url, outputKey(options, width, height),
+            [&](const cv::Mat &img, std::string &out) {
+              return renderToBuffer(img, options, out);
+            },
+            frame)) {
+      std::cerr << "Failed to load image: " << url << std::endl;
+      return false;
+    }
+    return outputSink(options)->write(frame, FrameInfo{});
+  }
+
   const auto response = cpr::Get(cpr::Url{std::string(url)});
   if (response.status_code != 200) {
     std::cerr << "Failed to download image. Status: " << response.status_code
@@ -118,22 +1064,16 @@ bool Sakura::renderFromUrl(std::string_view url) const {
 
 bool Sakura::renderFromMat(const cv::Mat &img,
                            const RenderOptions &options) const {
-  if (options.mode == SIXEL) {
-    cv::Mat processed;
-    if (img.cols != options.width || img.rows != options.height) {
-      cv::resize(img, processed, cv::Size(options.width, options.height), 0, 0,
-                 cv::INTER_NEAREST);
-    } else {
-      processed = img;
-    }
-
-    const std::string sixelData =
-        renderSixel(processed, options.paletteSize, options.width,
-                    options.height, options.sixelQuality);
-    std::cout << sixelData << std::flush;
-    return true;
+  std::string frame;
+  if (!renderToBuffer(img, options, frame)) {
+    return false;
   }
+  // Hand the terminal the whole frame in one write.
+  return outputSink(options)->write(frame, FrameInfo{});
+}
 
+bool Sakura::renderToBuffer(const cv::Mat &img, const RenderOptions &options,
+                            std::string &output) const {
   cv::Mat resized;
   int target_width, target_height;
   if (!preprocessAndResize(img, options, resized, target_width,
@@ -142,33 +1082,33 @@ bool Sakura::renderFromMat(const cv::Mat &img,
     return false;
   }
 
+  if (options.mode == SIXEL) {
+    output.clear();
+    return renderSixel(resized, output, options.paletteSize, target_width,
+                       target_height, options.sixelQuality, nullptr,
+                       options.sixelEncoder, options.quantizer);
+  }
+
   if ((options.mode == EXACT || options.mode == ASCII_COLOR) &&
       resized.channels() == 1) {
     cv::cvtColor(resized, resized, cv::COLOR_GRAY2BGR);
   }
 
-  std::vector<std::string> lines;
+  output.clear();
   switch (options.mode) {
   case EXACT:
-    lines = renderExact(resized, target_height);
-    break;
+    renderExact(resized, target_height, output);
+    return true;
   case ASCII_COLOR:
-    lines = renderAsciiColor(resized);
-    break;
-  case ASCII_GRAY: {
-    const std::string &charSet = getCharSet(options.style);
-    lines = renderAsciiGrayscale(resized, charSet, options.dither);
-    break;
-  }
+    renderAsciiColor(resized, output);
+    return true;
+  case ASCII_GRAY:
+    renderAsciiGrayscale(resized, getCharSet(options.style), options.dither,
+                         output);
+    return true;
   default:
     return false;
   }
-
-  for (const auto &line : lines) {
-    std::cout << line << '\n';
-  }
-  std::cout.flush();
-  return true;
 }
 
 const std::string &Sakura::getCharSet(CharStyle style) const noexcept {
@@ -184,174 +1124,819 @@ const std::string &Sakura::getCharSet(CharStyle style) const noexcept {
   }
 }
 
-std::vector<std::string> Sakura::renderExact(const cv::Mat &resized,
-                                             int terminal_height) const {
-  std::vector<std::string> lines;
-  const int height = resized.rows / 2;
-  const int width = resized.cols;
-  const int max_lines = std::min(height, terminal_height);
+namespace {
+// Decimal text of every byte value, so colour components are copied instead
+// of being formatted through std::to_string or a stream.
+struct DecimalTable {
+  char text[256][4] = {};
+  unsigned char length[256] = {};
 
-  lines.reserve(max_lines);
+  constexpr DecimalTable() {
+    for (int v = 0; v < 256; ++v) {
+      const int hundreds = v / 100;
+      const int tens = (v / 10) % 10;
+      int n = 0;
+      if (hundreds > 0)
+        text[v][n++] = static_cast<char>('0' + hundreds);
+      if (hundreds > 0 || tens > 0)
+        text[v][n++] = static_cast<char>('0' + tens);
+      text[v][n++] = static_cast<char>('0' + v % 10);
+      length[v] = static_cast<unsigned char>(n);
+    }
+  }
+};
+constexpr DecimalTable DECIMAL;
 
-  for (int k = 0; k < max_lines; ++k) {
-    std::string line;
-    line.reserve(width * 30); // Pre-allocate for ANSI sequences
+// Writes SGR sequences straight into a caller-owned buffer. Callers reserve
+// the worst case for a run of cells, write through the returned cursor and
+// commit where they stopped, so a warm buffer is never reallocated.
+class AnsiEncoder {
+public:
+  // "\x1b[48;2;255;255;255m"
+  static constexpr std::size_t MAX_COLOR_BYTES = 19;
 
-    for (int j = 0; j < width; ++j) {
-      const cv::Vec3b top_pixel = resized.at<cv::Vec3b>(2 * k, j);
-      const cv::Vec3b bottom_pixel = (2 * k + 1 < resized.rows)
-                                         ? resized.at<cv::Vec3b>(2 * k + 1, j)
-                                         : top_pixel;
-
-      std::ostringstream oss;
-      oss << "\x1b[48;2;" << static_cast<int>(bottom_pixel[2]) << ';'
-          << static_cast<int>(bottom_pixel[1]) << ';'
-          << static_cast<int>(bottom_pixel[0]) << "m\x1b[38;2;"
-          << static_cast<int>(top_pixel[2]) << ';'
-          << static_cast<int>(top_pixel[1]) << ';'
-          << static_cast<int>(top_pixel[0]) << "m▀\x1b[0m";
-      line += oss.str();
-    }
-    lines.emplace_back(std::move(line));
+  explicit AnsiEncoder(std::string &out) noexcept : out_(out) {}
+
+  // Hands out a per-thread scratch area of at least `bytes`; commit()
+  // appends what was written to the output. The scratch is never
+  // zero-filled, so a worst-case reservation costs nothing on the hot path.
+  // Only one reserve/commit pair is open per thread at a time.
+  char *reserve(std::size_t bytes) {
+    Scratch &scratch = threadScratch();
+    if (scratch.capacity < bytes) {
+      scratch.capacity = std::max(bytes, 2 * scratch.capacity);
+      scratch.data.reset(new char[scratch.capacity]);
+    }
+    return scratch.data.get();
   }
-  return lines;
-}
 
-std::vector<std::string>
-Sakura::renderAsciiColor(const cv::Mat &resized) const {
-  std::vector<std::string> lines;
-  const int height = resized.rows;
-  const int width = resized.cols;
+  void commit(const char *end) {
+    const char *begin = threadScratch().data.get();
+    out_.append(begin, static_cast<std::size_t>(end - begin));
+  }
 
-  lines.reserve(height);
+  static char *text(char *p, std::string_view s) noexcept {
+    std::memcpy(p, s.data(), s.size());
+    return p + s.size();
+  }
 
-  for (int i = 0; i < height; ++i) {
-    std::string line;
-    line.reserve(width * 20);
+  static char *background(char *p, const cv::Vec3b &bgr) noexcept {
+    return color(p, '4', bgr);
+  }
 
-    for (int j = 0; j < width; ++j) {
-      const cv::Vec3b pixel = resized.at<cv::Vec3b>(i, j);
-      std::ostringstream oss;
-      oss << "\x1b[48;2;" << static_cast<int>(pixel[2]) << ';'
-          << static_cast<int>(pixel[1]) << ';' << static_cast<int>(pixel[0])
-          << "m \x1b[0m";
-      line += oss.str();
-    }
-    lines.emplace_back(std::move(line));
+  static char *foreground(char *p, const cv::Vec3b &bgr) noexcept {
+    return color(p, '3', bgr);
   }
-  return lines;
-}
 
-std::vector<std::string> Sakura::renderAsciiGrayscale(const cv::Mat &resized,
-                                                      std::string_view charSet,
-                                                      DitherMode dither) const {
-  std::vector<std::string> lines;
-  cv::Mat gray;
+  // "\x1b[99999;99999H"
+  static constexpr std::size_t MAX_CURSOR_BYTES = 14;
 
-  if (resized.channels() == 3) {
-    cv::cvtColor(resized, gray, cv::COLOR_BGR2GRAY);
-  } else {
-    gray = resized;
+  // CUP to a 0-based cell.
+  static char *cursorTo(char *p, int row, int col) noexcept {
+    *p++ = '\x1b';
+    *p++ = '[';
+    p = std::to_chars(p, p + 5, row + 1).ptr;
+    *p++ = ';';
+    p = std::to_chars(p, p + 5, col + 1).ptr;
+    *p++ = 'H';
+    return p;
   }
 
-  const int height = gray.rows;
-  const int width = gray.cols;
-  const int num_chars = static_cast<int>(charSet.size());
+  static char *cursorForward(char *p, int cells) noexcept {
+    *p++ = '\x1b';
+    *p++ = '[';
+    p = std::to_chars(p, p + 5, cells).ptr;
+    *p++ = 'C';
+    return p;
+  }
 
-  lines.reserve(height);
+private:
+  struct Scratch {
+    std::unique_ptr<char[]> data;
+    std::size_t capacity = 0;
+  };
 
-  if (dither == FLOYD_STEINBERG) {
-    gray.convertTo(gray, CV_32F, 1.0 / 255.0);
-    cv::Mat error = cv::Mat::zeros(height, width, CV_32F);
+  static Scratch &threadScratch() {
+    thread_local Scratch scratch;
+    return scratch;
+  }
 
-    for (int i = 0; i < height; ++i) {
-      std::string line;
-      line.reserve(width);
+  // Always copies three digits; the reserved worst case covers the slack.
+  static char *number(char *p, uchar v) noexcept {
+    std::memcpy(p, DECIMAL.text[v], 3);
+    return p + DECIMAL.length[v];
+  }
 
-      for (int j = 0; j < width; ++j) {
-        // TODO: read more:
-        // https://en.wikipedia.org/wiki/Floyd%E2%80%93Steinberg_dithering
-        float old_value = std::clamp(
-            gray.at<float>(i, j) + error.at<float>(i, j), 0.0f, 1.0f);
-        int level = std::clamp(
-            static_cast<int>(std::round(old_value * (num_chars - 1))), 0,
-            num_chars - 1);
-        const float chosen_value = static_cast<float>(level) / (num_chars - 1);
-        const float err = old_value - chosen_value;
-
-        // Distribute error
-        if (j + 1 < width) {
-          error.at<float>(i, j + 1) += err * 7.0f / 16.0f;
+  static char *color(char *p, char layer, const cv::Vec3b &bgr) noexcept {
+    std::memcpy(p, "\x1b[48;2;", 7);
+    p[2] = layer;
+    p = number(p + 7, bgr[2]);
+    *p++ = ';';
+    p = number(p, bgr[1]);
+    *p++ = ';';
+    p = number(p, bgr[0]);
+    *p++ = 'm';
+    return p;
+  }
+
+  std::string &out_;
+};
+
+constexpr std::string_view UPPER_HALF_BLOCK = "▀";
+constexpr std::string_view SGR_RESET = "\x1b[0m";
+
+// Colours the terminal currently has set, so runs of equal colours are sent
+// once.
+struct SgrState {
+  bool has_background = false;
+  bool has_foreground = false;
+  cv::Vec3b background;
+  cv::Vec3b foreground;
+};
+
+constexpr std::size_t HALF_BLOCK_CELL_BYTES =
+    2 * AnsiEncoder::MAX_COLOR_BYTES + UPPER_HALF_BLOCK.size();
+
+// One half-block cell, skipping colours already in effect. A cell whose
+// halves match is drawn as a background-coloured space.
+char *emitHalfBlockCell(char *p, const cv::Vec3b &top, const cv::Vec3b &bottom,
+                        SgrState &state) noexcept {
+  if (!state.has_background || state.background != bottom) {
+    p = AnsiEncoder::background(p, bottom);
+    state.background = bottom;
+    state.has_background = true;
+  }
+  if (top == bottom) {
+    *p++ = ' ';
+    return p;
+  }
+  if (!state.has_foreground || state.foreground != top) {
+    p = AnsiEncoder::foreground(p, top);
+    state.foreground = top;
+    state.has_foreground = true;
+  }
+  return AnsiEncoder::text(p, UPPER_HALF_BLOCK);
+}
+
+// Inter-frame delta encoder for ULTRA_FAST playback. It remembers the colours
+// last sent for every cell, leaves cells within `threshold` (per channel) of
+// them alone and jumps over the gaps with cursor movement. Frames must be fed
+// in display order; the output needs no leading cursor home.
+class UltraFastDeltaEncoder {
+public:
+  explicit UltraFastDeltaEncoder(int threshold)
+      : threshold_(std::clamp(threshold, 0, 255)) {}
+
+  // Returns whether the whole frame was drawn.
+  bool encode(const cv::Mat &frame, std::string &out) {
+    if (frame.empty() || frame.channels() != 3)
+      return false;
+
+    const int rows = (frame.rows + 1) / 2;
+    const int cols = frame.cols;
+    const bool full = rows != rows_ || cols != cols_;
+
+    AnsiEncoder encoder(out);
+    if (full) {
+      // Geometry changed: forget the old grid and clear what it left behind.
+      if (!cells_.empty()) {
+        char *p = encoder.reserve(SGR_RESET.size() + 4);
+        p = AnsiEncoder::text(p, SGR_RESET);
+        p = AnsiEncoder::text(p, "\x1b[2J");
+        encoder.commit(p);
+      }
+      cells_.assign(static_cast<std::size_t>(rows) * cols, Cell{});
+      rows_ = rows;
+      cols_ = cols;
+    }
+
+    // Colours and cursor position are unknown until the first cell is sent.
+    SgrState state;
+    int cursor_row = -1;
+    int cursor_col = -1;
+    bool emitted = false;
+
+    for (int r = 0; r < rows; ++r) {
+      const cv::Vec3b *top = frame.ptr<cv::Vec3b>(2 * r);
+      const cv::Vec3b *bottom =
+          (2 * r + 1 < frame.rows) ? frame.ptr<cv::Vec3b>(2 * r + 1) : top;
+      Cell *cells = cells_.data() + static_cast<std::size_t>(r) * cols;
+
+      char *p = encoder.reserve(
+          static_cast<std::size_t>(cols) *
+          (HALF_BLOCK_CELL_BYTES + AnsiEncoder::MAX_CURSOR_BYTES));
+      for (int c = 0; c < cols; ++c) {
+        Cell &cell = cells[c];
+        if (!full && !changed(cell.top, top[c]) &&
+            !changed(cell.bottom, bottom[c])) {
+          continue;
         }
-        if (i + 1 < height) {
-          if (j - 1 >= 0) {
-            error.at<float>(i + 1, j - 1) += err * 3.0f / 16.0f;
-          }
-          error.at<float>(i + 1, j) += err * 5.0f / 16.0f;
-          if (j + 1 < width) {
-            error.at<float>(i + 1, j + 1) += err * 1.0f / 16.0f;
-          }
+        if (cursor_row == r && cursor_col >= 0 && cursor_col < c) {
+          p = AnsiEncoder::cursorForward(p, c - cursor_col);
+        } else if (cursor_row != r || cursor_col != c) {
+          p = AnsiEncoder::cursorTo(p, r, c);
         }
-        line += charSet[level];
+        p = emitHalfBlockCell(p, top[c], bottom[c], state);
+        cell.top = top[c];
+        cell.bottom = bottom[c];
+        cursor_row = r;
+        // Past the last column the terminal's wrap state is not reliable.
+        cursor_col = (c + 1 < cols) ? c + 1 : -1;
+        emitted = true;
       }
-      lines.emplace_back(std::move(line));
+      encoder.commit(p);
+    }
+
+    if (emitted) {
+      char *p = encoder.reserve(SGR_RESET.size());
+      encoder.commit(AnsiEncoder::text(p, SGR_RESET));
+    }
+    return full;
+  }
+
+  // Makes the next frame a full redraw, without clearing the screen.
+  void reset() {
+    cells_.clear();
+    rows_ = 0;
+    cols_ = 0;
+  }
+
+private:
+  struct Cell {
+    cv::Vec3b top;
+    cv::Vec3b bottom;
+  };
+
+  bool changed(const cv::Vec3b &before, const cv::Vec3b &after) const {
+    for (int ch = 0; ch < 3; ++ch) {
+      if (std::abs(static_cast<int>(before[ch]) - after[ch]) > threshold_)
+        return true;
     }
+    return false;
+  }
+
+  const int threshold_;
+  int rows_ = 0;
+  int cols_ = 0;
+  std::vector<Cell> cells_;
+};
+} // namespace
+
+namespace {
+// The cell renderers encode each terminal row independently. Rows are
+// spread across cv::parallel_for_ (or run in order when `parallel` is
+// false) into fixed-stride slots of a per-thread scratch area, each at most
+// `row_bytes` long, and then appended to `out` in order with a newline
+// each, so the frame is one contiguous buffer and the output is the same as
+// a serial pass. `encode_row(i, p)` writes row i at p and returns its end.
+// Once the scratch and `out` are warm, nothing is allocated.
+template <typename EncodeRow>
+void encodeRows(int rows, std::size_t row_bytes, bool parallel,
+                std::string &out, EncodeRow &&encode_row) {
+  struct RowScratch {
+    std::unique_ptr<char[]> data;
+    std::size_t capacity = 0;
+    std::vector<std::size_t> lengths;
+  };
+  thread_local RowScratch scratch;
+  const std::size_t needed = static_cast<std::size_t>(rows) * row_bytes;
+  if (scratch.capacity < needed) {
+    scratch.capacity = std::max(needed, 2 * scratch.capacity);
+    scratch.data.reset(new char[scratch.capacity]);
+  }
+  scratch.lengths.resize(static_cast<std::size_t>(rows));
+  char *const slots = scratch.data.get();
+  std::size_t *const lengths = scratch.lengths.data();
+  const auto encode = [&](int i) {
+    char *const begin = slots + static_cast<std::size_t>(i) * row_bytes;
+    lengths[i] = static_cast<std::size_t>(encode_row(i, begin) - begin);
+  };
+  if (parallel) {
+    cv::parallel_for_(cv::Range(0, rows), [&](const cv::Range &range) {
+      for (int i = range.start; i < range.end; ++i)
+        encode(i);
+    });
   } else {
-    for (int i = 0; i < height; ++i) {
-      std::string line;
-      line.reserve(width);
+    for (int i = 0; i < rows; ++i)
+      encode(i);
+  }
+
+  std::size_t total = 0;
+  for (int i = 0; i < rows; ++i)
+    total += lengths[i] + 1;
+  out.reserve(out.size() + total);
+  for (int i = 0; i < rows; ++i) {
+    out.append(slots + static_cast<std::size_t>(i) * row_bytes, lengths[i]);
+    out += '\n';
+  }
+}
+} // namespace
+
+void Sakura::renderExact(const cv::Mat &resized, int terminal_height,
+                         std::string &output) const {
+  const int height = resized.rows / 2;
+  const int width = resized.cols;
+  const int max_lines = std::max(0, std::min(height, terminal_height));
+
+  constexpr std::size_t cell_bytes = 2 * AnsiEncoder::MAX_COLOR_BYTES +
+                                     UPPER_HALF_BLOCK.size() + SGR_RESET.size();
+
+  encodeRows(max_lines, width * cell_bytes, true, output, [&](int k, char *p) {
+    const cv::Vec3b *top = resized.ptr<cv::Vec3b>(2 * k);
+    const cv::Vec3b *bottom =
+        (2 * k + 1 < resized.rows) ? resized.ptr<cv::Vec3b>(2 * k + 1) : top;
+    for (int j = 0; j < width; ++j) {
+      p = AnsiEncoder::background(p, bottom[j]);
+      p = AnsiEncoder::foreground(p, top[j]);
+      p = AnsiEncoder::text(p, UPPER_HALF_BLOCK);
+      p = AnsiEncoder::text(p, SGR_RESET);
+    }
+    return p;
+  });
+}
+
+void Sakura::renderAsciiColor(const cv::Mat &resized,
+                              std::string &output) const {
+  const int width = resized.cols;
+
+  constexpr std::size_t cell_bytes =
+      AnsiEncoder::MAX_COLOR_BYTES + 1 + SGR_RESET.size();
+
+  encodeRows(resized.rows, width * cell_bytes, true, output,
+             [&](int i, char *p) {
+               const cv::Vec3b *row = resized.ptr<cv::Vec3b>(i);
+               for (int j = 0; j < width; ++j) {
+                 p = AnsiEncoder::background(p, row[j]);
+                 *p++ = ' ';
+                 p = AnsiEncoder::text(p, SGR_RESET);
+               }
+               return p;
+             });
+}
+
+namespace {
+// A charset split into whole UTF-8 characters, so multi-byte glyphs such as
+// the BLOCKS shades count as one level each. Every glyph is pre-encoded in a
+// fixed four-byte slot and copied with one store, advancing by its real
+// length; single-byte charsets keep a plain byte-per-cell path.
+class GlyphRamp {
+public:
+  explicit GlyphRamp(std::string_view charSet) {
+    for (std::size_t i = 0; i < charSet.size() && glyphs_.size() < 256;) {
+      std::size_t length = 1;
+      while (i + length < charSet.size() &&
+             (static_cast<uchar>(charSet[i + length]) & 0xC0) == 0x80) {
+        ++length;
+      }
+      Glyph glyph{};
+      glyph.size = static_cast<uchar>(std::min<std::size_t>(length, SLOT));
+      std::memcpy(glyph.bytes, charSet.data() + i, glyph.size);
+      glyphs_.push_back(glyph);
+      max_size_ = std::max<int>(max_size_, glyph.size);
+      i += length;
+    }
+    if (glyphs_.empty()) {
+      glyphs_.push_back(Glyph{{' '}, 1});
+    }
+    const int levels = static_cast<int>(glyphs_.size());
+    for (int intensity = 0; intensity < 256; ++intensity) {
+      by_intensity_[intensity] = glyphs_[(intensity * (levels - 1)) / 255];
+    }
+  }
+
+  int levels() const { return static_cast<int>(glyphs_.size()); }
 
+  // Room a row of `width` glyphs may need, slack for the last slot copy
+  // included.
+  std::size_t rowBytes(int width) const {
+    return static_cast<std::size_t>(width) * max_size_ + SLOT;
+  }
+
+  // Writes the glyphs for a row of ramp levels at `out`; returns the end.
+  char *writeLevels(const uchar *levels, int width, char *out) const {
+    return write(levels, width, glyphs_.data(), out);
+  }
+
+  // Same, straight from intensities, without dithering.
+  char *writeIntensities(const uchar *row, int width, char *out) const {
+    return write(row, width, by_intensity_, out);
+  }
+
+private:
+  static constexpr int SLOT = 4; // longest UTF-8 sequence
+  struct Glyph {
+    char bytes[SLOT];
+    uchar size;
+  };
+
+  char *write(const uchar *values, int width, const Glyph *table,
+              char *out) const {
+    if (max_size_ == 1) {
       for (int j = 0; j < width; ++j) {
-        const int intensity = gray.at<uchar>(i, j);
-        const int idx = (intensity * (num_chars - 1)) / 255;
-        line += charSet[idx];
+        out[j] = table[values[j]].bytes[0];
       }
-      lines.emplace_back(std::move(line));
+      return out + width;
     }
+    // Every copy is a whole slot; rowBytes() leaves room past the last one.
+    for (int j = 0; j < width; ++j) {
+      const Glyph &glyph = table[values[j]];
+      std::memcpy(out, glyph.bytes, SLOT);
+      out += glyph.size;
+    }
+    return out;
+  }
+
+  std::vector<Glyph> glyphs_;
+  Glyph by_intensity_[256];
+  int max_size_ = 1;
+};
+
+// Ramps are built once per distinct charset and kept for the process.
+const GlyphRamp &glyphRamp(std::string_view charSet) {
+  static std::mutex mutex;
+  static std::map<std::string, GlyphRamp, std::less<>> ramps;
+  std::lock_guard<std::mutex> lock(mutex);
+  auto it = ramps.find(charSet);
+  if (it == ramps.end()) {
+    it = ramps.try_emplace(std::string(charSet), charSet).first;
+  }
+  return it->second;
+}
+
+// Error diffusion over the glyph ramp. Intensities are fixed point in 1/16
+// steps and the error lives in two rolling rows padded by one cell on each
+// side, so memory is O(width) and the kernel needs no edge checks. Each
+// pixel's error is split 7/3/5/1 with the remainder going to the last tap,
+// so none is lost to rounding. Serpentine order alternates the scan
+// direction per row, which breaks up the diagonal worms of a raster scan.
+void floydSteinbergRows(const cv::Mat &gray, const GlyphRamp &ramp,
+                        bool serpentine, std::string &out) {
+  const int width = gray.cols;
+  const int levels = ramp.levels();
+  constexpr int ONE = 16;
+  constexpr int MAX_VALUE = 255 * ONE;
+
+  // Nearest level for a rounded intensity, and each level's fixed-point
+  // intensity.
+  uchar level_of[256];
+  for (int v = 0; v < 256; ++v) {
+    level_of[v] = static_cast<uchar>((v * (levels - 1) + 127) / 255);
+  }
+  int level_value[256];
+  for (int level = 0; level < levels; ++level) {
+    level_value[level] =
+        levels > 1 ? (level * MAX_VALUE + (levels - 1) / 2) / (levels - 1) : 0;
+  }
+
+  // Kept per thread, so a warm frame allocates nothing.
+  thread_local std::vector<int> current, next;
+  thread_local std::vector<uchar> row_levels;
+  current.assign(width + 2, 0);
+  next.assign(width + 2, 0);
+  row_levels.resize(width);
+  // Rows depend on the error of the one above, so they run in order.
+  encodeRows(gray.rows, ramp.rowBytes(width), false, out, [&](int i, char *p) {
+    const uchar *row = gray.ptr<uchar>(i);
+    const bool reverse = serpentine && (i & 1);
+    const int step = reverse ? -1 : 1;
+    int *err = current.data() + 1;
+    int *below = next.data() + 1;
+
+    for (int n = 0, j = reverse ? width - 1 : 0; n < width; ++n, j += step) {
+      const int value = std::clamp((row[j] << 4) + err[j], 0, MAX_VALUE);
+      const int level = level_of[(value + ONE / 2) >> 4];
+      const int e = value - level_value[level];
+      const int ahead = e * 7 / 16;
+      const int behind_below = e * 3 / 16;
+      const int straight_below = e * 5 / 16;
+      err[j + step] += ahead;
+      below[j - step] += behind_below;
+      below[j] += straight_below;
+      below[j + step] += e - ahead - behind_below - straight_below;
+      row_levels[j] = static_cast<uchar>(level);
+    }
+    current.swap(next);
+    std::fill(next.begin(), next.end(), 0);
+    return ramp.writeLevels(row_levels.data(), width, p);
+  });
+}
+
+// Ordered dithering against an 8x8 Bayer matrix. Every pixel is
+// independent, so rows run in parallel, and the pattern is fixed in screen
+// space, so static regions of a video do not shimmer between frames.
+void bayerRows(const cv::Mat &gray, const GlyphRamp &ramp, std::string &out) {
+  static constexpr uchar BAYER8[8][8] = {
+      {0, 32, 8, 40, 2, 34, 10, 42},   {48, 16, 56, 24, 50, 18, 58, 26},
+      {12, 44, 4, 36, 14, 46, 6, 38},  {60, 28, 52, 20, 62, 30, 54, 22},
+      {3, 35, 11, 43, 1, 33, 9, 41},   {51, 19, 59, 27, 49, 17, 57, 25},
+      {15, 47, 7, 39, 13, 45, 5, 37},  {63, 31, 55, 23, 61, 29, 53, 21}};
+  const int width = gray.cols;
+  const int levels = ramp.levels();
+
+  // level = floor(v * (levels - 1) / 255 + (2m + 1) / 128)
+  encodeRows(gray.rows, ramp.rowBytes(width), true, out, [&](int i, char *p) {
+    thread_local std::vector<uchar> row_levels;
+    row_levels.resize(width);
+    const uchar *row = gray.ptr<uchar>(i);
+    const uchar *threshold = BAYER8[i & 7];
+    for (int j = 0; j < width; ++j) {
+      const int t =
+          row[j] * (levels - 1) * 128 + (2 * threshold[j & 7] + 1) * 255;
+      row_levels[j] =
+          static_cast<uchar>(std::min(t / (255 * 128), levels - 1));
+    }
+    return ramp.writeLevels(row_levels.data(), width, p);
+  });
+}
+} // namespace
+
+void Sakura::renderAsciiGrayscale(const cv::Mat &resized,
+                                  std::string_view charSet, DitherMode dither,
+                                  std::string &output) const {
+  thread_local cv::Mat converted; // reused while the size holds
+  cv::Mat gray;
+  if (resized.channels() == 3) {
+    cv::cvtColor(resized, converted, cv::COLOR_BGR2GRAY);
+    gray = converted;
+  } else {
+    gray = resized;
+  }
+
+  const int height = gray.rows;
+  const int width = gray.cols;
+  const GlyphRamp &ramp = glyphRamp(charSet);
+
+  switch (dither) {
+  case FLOYD_STEINBERG:
+  case FLOYD_STEINBERG_SERPENTINE:
+    floydSteinbergRows(gray, ramp, dither == FLOYD_STEINBERG_SERPENTINE,
+                       output);
+    break;
+  case BAYER:
+    bayerRows(gray, ramp, output);
+    break;
+  case NONE:
+  default:
+    encodeRows(height, ramp.rowBytes(width), true, output,
+               [&](int i, char *p) {
+                 return ramp.writeIntensities(gray.ptr<uchar>(i), width, p);
+               });
+    break;
   }
-  return lines;
 }
 
+// The frame from renderToBuffer, split into its lines.
 std::vector<std::string>
 Sakura::renderImageToLines(const cv::Mat &img,
                            const RenderOptions &options) const {
-  cv::Mat resized;
-  int target_width, target_height;
-  if (!preprocessAndResize(img, options, resized, target_width,
-                           target_height)) {
-    std::cerr << "Resize failed" << std::endl;
+  std::string frame;
+  if (options.mode == SIXEL || !renderToBuffer(img, options, frame))
     return {};
+  std::vector<std::string> lines;
+  for (std::size_t begin = 0; begin < frame.size();) {
+    const std::size_t end = frame.find('\n', begin);
+    lines.emplace_back(frame, begin, end - begin);
+    begin = end + 1;
   }
+  return lines;
+}
 
-  if ((options.mode == EXACT || options.mode == ASCII_COLOR) &&
-      resized.channels() == 1) {
-    cv::cvtColor(resized, resized, cv::COLOR_GRAY2BGR);
+namespace {
+// Colour-cube resolution shared by the histogram quantizers and the inverse
+// colour lookup table: 5 bits per channel, 32768 cells.
+constexpr int CUBE_BITS = 5;
+constexpr int CUBE_SIDE = 1 << CUBE_BITS;
+constexpr int CUBE_CELLS = CUBE_SIDE * CUBE_SIDE * CUBE_SIDE;
+
+inline int cubeIndex(int b, int g, int r) noexcept {
+  return (b << (2 * CUBE_BITS)) | (g << CUBE_BITS) | r;
+}
+
+inline int cubeIndex(const cv::Vec3b &bgr) noexcept {
+  constexpr int shift = 8 - CUBE_BITS;
+  return cubeIndex(bgr[0] >> shift, bgr[1] >> shift, bgr[2] >> shift);
+}
+
+struct CubeCell {
+  std::uint32_t count = 0;
+  std::uint64_t sum[3] = {0, 0, 0}; // B, G, R
+};
+
+// One linear pass over the image; the quantizers below only ever look at
+// the 32768 cells.
+std::vector<CubeCell> colorCubeHistogram(const cv::Mat &bgr) {
+  std::vector<CubeCell> cube(CUBE_CELLS);
+  for (int y = 0; y < bgr.rows; ++y) {
+    const cv::Vec3b *row = bgr.ptr<cv::Vec3b>(y);
+    for (int x = 0; x < bgr.cols; ++x) {
+      CubeCell &cell = cube[cubeIndex(row[x])];
+      ++cell.count;
+      cell.sum[0] += row[x][0];
+      cell.sum[1] += row[x][1];
+      cell.sum[2] += row[x][2];
+    }
   }
+  return cube;
+}
 
-  switch (options.mode) {
-  case EXACT:
-    return renderExact(resized, target_height);
-  case ASCII_COLOR:
-    return renderAsciiColor(resized);
-  case ASCII_GRAY: {
-    const std::string &charSet = getCharSet(options.style);
-    return renderAsciiGrayscale(resized, charSet, options.dither);
+cv::Vec3b meanColor(const std::uint64_t (&sum)[3], std::uint64_t count) {
+  return cv::Vec3b(static_cast<uchar>((sum[0] + count / 2) / count),
+                   static_cast<uchar>((sum[1] + count / 2) / count),
+                   static_cast<uchar>((sum[2] + count / 2) / count));
+}
+
+cv::Mat paletteFromColors(const std::vector<cv::Vec3b> &colors) {
+  cv::Mat palette(static_cast<int>(colors.size()), 1, CV_8UC3);
+  for (int i = 0; i < palette.rows; ++i) {
+    palette.at<cv::Vec3b>(i) = colors[i];
   }
-  default:
-    return {};
+  return palette;
+}
+
+// Median cut over the colour cube: repeatedly split the box with the largest
+// population times extent at the population median of its longest axis.
+cv::Mat medianCutPalette(const std::vector<CubeCell> &cube, int numColors) {
+  struct Box {
+    int lo[3];
+    int hi[3];
+    std::uint64_t count;
+  };
+
+  const auto for_each_cell = [&](const Box &box, auto &&fn) {
+    for (int b = box.lo[0]; b <= box.hi[0]; ++b)
+      for (int g = box.lo[1]; g <= box.hi[1]; ++g)
+        for (int r = box.lo[2]; r <= box.hi[2]; ++r)
+          fn(b, g, r, cube[cubeIndex(b, g, r)]);
+  };
+
+  // Tightens a box to its populated cells; false when it holds none.
+  const auto shrink = [&](Box &box) {
+    int lo[3] = {CUBE_SIDE, CUBE_SIDE, CUBE_SIDE};
+    int hi[3] = {-1, -1, -1};
+    std::uint64_t count = 0;
+    for_each_cell(box, [&](int b, int g, int r, const CubeCell &cell) {
+      if (cell.count == 0)
+        return;
+      const int v[3] = {b, g, r};
+      for (int c = 0; c < 3; ++c) {
+        lo[c] = std::min(lo[c], v[c]);
+        hi[c] = std::max(hi[c], v[c]);
+      }
+      count += cell.count;
+    });
+    std::copy(lo, lo + 3, box.lo);
+    std::copy(hi, hi + 3, box.hi);
+    box.count = count;
+    return count > 0;
+  };
+
+  std::vector<Box> boxes;
+  Box all{{0, 0, 0}, {CUBE_SIDE - 1, CUBE_SIDE - 1, CUBE_SIDE - 1}, 0};
+  if (shrink(all))
+    boxes.push_back(all);
+
+  while (static_cast<int>(boxes.size()) < numColors) {
+    int best = -1;
+    int axis = 0;
+    double best_score = 0.0;
+    for (int i = 0; i < static_cast<int>(boxes.size()); ++i) {
+      const Box &box = boxes[i];
+      for (int c = 0; c < 3; ++c) {
+        const int extent = box.hi[c] - box.lo[c];
+        const double score = static_cast<double>(box.count) * extent;
+        if (extent > 0 && score > best_score) {
+          best = i;
+          axis = c;
+          best_score = score;
+        }
+      }
+    }
+    if (best < 0)
+      break; // every box is a single cell
+
+    Box &box = boxes[best];
+    std::uint64_t marginal[CUBE_SIDE] = {};
+    for_each_cell(box, [&](int b, int g, int r, const CubeCell &cell) {
+      const int v[3] = {b, g, r};
+      marginal[v[axis]] += cell.count;
+    });
+    int split = box.lo[axis];
+    std::uint64_t below = marginal[split];
+    while (split + 1 < box.hi[axis] && below * 2 < box.count) {
+      below += marginal[++split];
+    }
+
+    Box upper = box;
+    box.hi[axis] = split;
+    upper.lo[axis] = split + 1;
+    shrink(box);
+    if (shrink(upper))
+      boxes.push_back(upper);
+  }
+
+  std::vector<cv::Vec3b> colors;
+  colors.reserve(boxes.size());
+  for (const Box &box : boxes) {
+    std::uint64_t sum[3] = {0, 0, 0};
+    for_each_cell(box, [&](int, int, int, const CubeCell &cell) {
+      for (int c = 0; c < 3; ++c)
+        sum[c] += cell.sum[c];
+    });
+    colors.push_back(meanColor(sum, box.count));
   }
+  return paletteFromColors(colors);
 }
 
-cv::Mat Sakura::quantizeImage(const cv::Mat &inputImg, int numColors,
-                              cv::Mat &palette) const {
-  // this part is just textbook implementation for noow
-  cv::Mat sourceImg;
-  if (inputImg.channels() == 1) {
-    cv::cvtColor(inputImg, sourceImg, cv::COLOR_GRAY2BGR);
-  } else {
-    sourceImg = inputImg;
+// Octree over the colour cube: cells are inserted with their weight, then the
+// least populated nodes are folded into their parents, deepest level first,
+// until at most numColors leaves remain.
+cv::Mat octreePalette(const std::vector<CubeCell> &cube, int numColors) {
+  struct Node {
+    int children[8] = {-1, -1, -1, -1, -1, -1, -1, -1};
+    std::uint64_t count = 0;
+    std::uint64_t sum[3] = {0, 0, 0};
+    bool leaf = false;
+  };
+
+  std::vector<Node> nodes(1);
+  std::vector<int> levels[CUBE_BITS]; // internal nodes by depth
+  levels[0].push_back(0);
+  int leaves = 0;
+
+  for (int index = 0; index < CUBE_CELLS; ++index) {
+    const CubeCell &cell = cube[index];
+    if (cell.count == 0)
+      continue;
+    const int b = index >> (2 * CUBE_BITS);
+    const int g = (index >> CUBE_BITS) & (CUBE_SIDE - 1);
+    const int r = index & (CUBE_SIDE - 1);
+
+    int node = 0;
+    for (int depth = 0;; ++depth) {
+      nodes[node].count += cell.count;
+      for (int c = 0; c < 3; ++c)
+        nodes[node].sum[c] += cell.sum[c];
+      if (depth == CUBE_BITS)
+        break;
+      const int bit = CUBE_BITS - 1 - depth;
+      const int child = (((b >> bit) & 1) << 2) | (((g >> bit) & 1) << 1) |
+                        ((r >> bit) & 1);
+      if (nodes[node].children[child] < 0) {
+        const int created = static_cast<int>(nodes.size());
+        nodes[node].children[child] = created;
+        nodes.emplace_back();
+        if (depth + 1 == CUBE_BITS) {
+          nodes.back().leaf = true;
+          ++leaves;
+        } else {
+          levels[depth + 1].push_back(created);
+        }
+      }
+      node = nodes[node].children[child];
+    }
+  }
+
+  for (int depth = CUBE_BITS - 1; depth >= 0 && leaves > numColors; --depth) {
+    std::vector<int> &level = levels[depth];
+    std::sort(level.begin(), level.end(), [&](int a, int b) {
+      return nodes[a].count < nodes[b].count;
+    });
+    for (int node : level) {
+      if (leaves <= numColors)
+        break;
+      int children = 0;
+      for (int &child : nodes[node].children) {
+        if (child >= 0) {
+          ++children;
+          child = -1;
+        }
+      }
+      nodes[node].leaf = true;
+      leaves -= children - 1;
+    }
+  }
+
+  // Reachable leaves, in tree order.
+  std::vector<cv::Vec3b> colors;
+  colors.reserve(leaves);
+  std::vector<int> stack = {0};
+  while (!stack.empty()) {
+    const Node &node = nodes[stack.back()];
+    stack.pop_back();
+    if (node.leaf) {
+      if (node.count > 0)
+        colors.push_back(meanColor(node.sum, node.count));
+      continue;
+    }
+    for (int child : node.children) {
+      if (child >= 0)
+        stack.push_back(child);
+    }
   }
+  return paletteFromColors(colors);
+}
 
+cv::Mat kmeansPalette(const cv::Mat &sourceImg, int numColors) {
   cv::Mat workingImg;
   constexpr int MAX_PIXELS = 65536;
   if (sourceImg.rows * sourceImg.cols > MAX_PIXELS) {
@@ -367,40 +1952,110 @@ cv::Mat Sakura::quantizeImage(const cv::Mat &inputImg, int numColors,
 
   cv::Mat samples = workingImg.reshape(1, workingImg.rows * workingImg.cols);
   samples.convertTo(samples, CV_32F);
+  numColors = std::min(numColors, samples.rows);
 
-  cv::Mat labels, centers;
+  cv::Mat labels, centers, palette;
   cv::kmeans(samples, numColors, labels,
              cv::TermCriteria(cv::TermCriteria::EPS + cv::TermCriteria::COUNT,
                               20, 1.0),
              5, cv::KMEANS_PP_CENTERS, centers);
 
   centers.convertTo(palette, CV_8UC1);
-  palette = palette.reshape(3, numColors);
-
-  cv::Mat quantizedImg(sourceImg.size(), CV_8U);
-  for (int y = 0; y < sourceImg.rows; ++y) {
-    for (int x = 0; x < sourceImg.cols; ++x) {
-      const cv::Vec3b pixel = sourceImg.at<cv::Vec3b>(y, x);
-
-      int bestIdx = 0;
-      double minDistSq = std::numeric_limits<double>::max();
-
-      for (int i = 0; i < numColors; ++i) {
-        const cv::Vec3b paletteColor = palette.at<cv::Vec3b>(i);
-        double distSq = 0;
-        for (int c = 0; c < 3; ++c) {
-          const double diff = pixel[c] - paletteColor[c];
-          distSq += diff * diff;
-        }
-        if (distSq < minDistSq) {
-          minDistSq = distSq;
-          bestIdx = i;
+  return palette.reshape(3, numColors);
+}
+
+// Inverse colour map: the nearest palette entry for the centre of every
+// colour-cube cell, so mapping a pixel is a single table load. Distances are
+// evaluated over structure-of-arrays integer planes, which the compiler turns
+// into SIMD code.
+std::vector<uchar> buildInverseColorLut(const cv::Mat &palette) {
+  const int n = palette.rows * palette.cols;
+  std::vector<int> plane_b(n), plane_g(n), plane_r(n);
+  for (int i = 0; i < n; ++i) {
+    const cv::Vec3b color = palette.at<cv::Vec3b>(i);
+    plane_b[i] = color[0];
+    plane_g[i] = color[1];
+    plane_r[i] = color[2];
+  }
+
+  std::vector<uchar> lut(CUBE_CELLS);
+  constexpr int shift = 8 - CUBE_BITS;
+  constexpr int half = 1 << (shift - 1);
+  cv::parallel_for_(cv::Range(0, CUBE_SIDE), [&](const cv::Range &range) {
+    std::vector<int> distance(n);
+    for (int b = range.start; b < range.end; ++b) {
+      const int cb = (b << shift) + half;
+      for (int g = 0; g < CUBE_SIDE; ++g) {
+        const int cg = (g << shift) + half;
+        for (int r = 0; r < CUBE_SIDE; ++r) {
+          const int cr = (r << shift) + half;
+          for (int i = 0; i < n; ++i) {
+            const int db = cb - plane_b[i];
+            const int dg = cg - plane_g[i];
+            const int dr = cr - plane_r[i];
+            distance[i] = db * db + dg * dg + dr * dr;
+          }
+          const auto nearest =
+              std::min_element(distance.begin(), distance.end());
+          lut[cubeIndex(b, g, r)] =
+              static_cast<uchar>(nearest - distance.begin());
         }
       }
-      quantizedImg.at<uchar>(y, x) = static_cast<uchar>(bestIdx);
     }
+  });
+  return lut;
+}
+
+void mapToPalette(const cv::Mat &bgr, const std::vector<uchar> &lut,
+                  cv::Mat &indices) {
+  indices.create(bgr.size(), CV_8U);
+  cv::parallel_for_(cv::Range(0, bgr.rows), [&](const cv::Range &range) {
+    for (int y = range.start; y < range.end; ++y) {
+      const cv::Vec3b *row = bgr.ptr<cv::Vec3b>(y);
+      uchar *out = indices.ptr<uchar>(y);
+      for (int x = 0; x < bgr.cols; ++x) {
+        out[x] = lut[cubeIndex(row[x])];
+      }
+    }
+  });
+}
+
+// The histogram quantizers run in linear time; k-means is kept for callers
+// that want its (much slower) clustering. The palette may come back smaller
+// than numColors when the image has fewer distinct colours.
+cv::Mat buildPalette(const cv::Mat &bgr, int numColors,
+                     Sakura::Quantizer method) {
+  numColors = std::clamp(numColors, 1, 256);
+  switch (method) {
+  case Sakura::KMEANS:
+    return kmeansPalette(bgr, numColors);
+  case Sakura::OCTREE:
+    return octreePalette(colorCubeHistogram(bgr), numColors);
+  case Sakura::MEDIAN_CUT:
+  default:
+    return medianCutPalette(colorCubeHistogram(bgr), numColors);
+  }
+}
+} // namespace
+
+cv::Mat Sakura::quantizeImage(const cv::Mat &inputImg, int numColors,
+                              cv::Mat &palette, Quantizer method) const {
+  cv::Mat sourceImg;
+  if (inputImg.channels() == 1) {
+    cv::cvtColor(inputImg, sourceImg, cv::COLOR_GRAY2BGR);
+  } else if (inputImg.channels() == 4) {
+    cv::cvtColor(inputImg, sourceImg, cv::COLOR_BGRA2BGR);
+  } else {
+    sourceImg = inputImg;
+  }
+  if (sourceImg.empty()) {
+    palette = cv::Mat();
+    return {};
   }
 
+  palette = buildPalette(sourceImg, numColors, method);
+  cv::Mat quantizedImg;
+  mapToPalette(sourceImg, buildInverseColorLut(palette), quantizedImg);
   return quantizedImg;
 }
 
@@ -410,394 +2065,2709 @@ int string_writer(char *data, int size, void *priv) {
   sixel_string->append(data, size);
   return size;
 }
-} // namespace
 
-std::string Sakura::renderSixel(const cv::Mat &img, int paletteSize,
-                                int output_width, int output_height,
-                                SixelQuality quality) const {
-  if (img.empty() || img.cols <= 0 || img.rows <= 0) {
-    return "";
+// Use RAII for sixel resources
+struct SixelOutputDeleter {
+  void operator()(sixel_output_t *p) const {
+    if (p)
+      sixel_output_unref(p);
+  }
+};
+struct SixelDitherDeleter {
+  void operator()(sixel_dither_t *p) const {
+    if (p)
+      sixel_dither_unref(p);
   }
+};
+using SixelDitherPtr = std::unique_ptr<sixel_dither_t, SixelDitherDeleter>;
 
-  // Validate input parameters
-  if (paletteSize <= 0 || paletteSize > 256) {
-    paletteSize = 256; // Fallback to safe value
+SixelDitherPtr newSixelDither(const cv::Mat &rgb_img, int paletteSize,
+                              Sakura::SixelQuality quality) {
+  sixel_dither_t *raw_dither = nullptr;
+  if (sixel_dither_new(&raw_dither, paletteSize, nullptr) != SIXEL_OK ||
+      raw_dither == nullptr) {
+    return nullptr;
   }
+  SixelDitherPtr dither(raw_dither);
 
-  cv::Mat rgb_img;
-  if (img.channels() == 3) {
-    cv::cvtColor(img, rgb_img, cv::COLOR_BGR2RGB);
-  } else if (img.channels() == 4) {
-    cv::cvtColor(img, rgb_img, cv::COLOR_BGRA2RGB);
-  } else if (img.channels() == 1) {
-    cv::cvtColor(img, rgb_img, cv::COLOR_GRAY2RGB);
-  } else {
-    return ""; // Unsupported format
+  int sixel_quality_mode =
+      (quality == Sakura::HIGH) ? SIXEL_QUALITY_HIGH : SIXEL_QUALITY_LOW;
+
+  if (sixel_dither_initialize(dither.get(), rgb_img.data, rgb_img.cols,
+                              rgb_img.rows, SIXEL_PIXELFORMAT_RGB888,
+                              SIXEL_LARGE_AUTO, SIXEL_REP_CENTER_BOX,
+                              sixel_quality_mode) != SIXEL_OK) {
+    return nullptr;
+  }
+  return dither;
+}
+
+// Coarse per-channel colour histogram (16 bins each, normalised), sampled on
+// a sparse grid; cheap enough to run on every frame.
+using ColorHistogram = std::array<float, 48>;
+
+ColorHistogram colorHistogram(const cv::Mat &rgb_img) {
+  ColorHistogram histogram{};
+  constexpr int samples_per_axis = 64;
+  const int step_y = std::max(1, rgb_img.rows / samples_per_axis);
+  const int step_x = std::max(1, rgb_img.cols / samples_per_axis);
+  int count = 0;
+  for (int y = 0; y < rgb_img.rows; y += step_y) {
+    const cv::Vec3b *row = rgb_img.ptr<cv::Vec3b>(y);
+    for (int x = 0; x < rgb_img.cols; x += step_x) {
+      for (int c = 0; c < 3; ++c) {
+        histogram[c * 16 + (row[x][c] >> 4)] += 1.0f;
+      }
+      ++count;
+    }
+  }
+  if (count > 0) {
+    for (float &bin : histogram) {
+      bin /= static_cast<float>(count);
+    }
+  }
+  return histogram;
+}
+
+// 0 for identical colour distributions, 1 for disjoint ones.
+double histogramDistance(const ColorHistogram &a, const ColorHistogram &b) {
+  double distance = 0.0;
+  for (std::size_t i = 0; i < a.size(); ++i) {
+    distance += std::abs(a[i] - b[i]);
+  }
+  return distance / 6.0;
+}
+
+// Palette shared by several encodes: the settings it was built with, the
+// colour registers, their inverse colour map, and the same registers as the
+// RGB triples libsixel takes. Immutable once built, so encodes keep using
+// one while a scene cut publishes its replacement. The only mutable part is
+// a pool of libsixel dithers loaded with the registers: each encode borrows
+// one for itself, and they are freed along with the palette.
+struct SixelColors {
+  Sakura::SixelEncoder encoder = Sakura::LIBSIXEL;
+  Sakura::SixelQuality quality = Sakura::HIGH;
+  Sakura::Quantizer quantizer = Sakura::MEDIAN_CUT;
+  int size = 0;   // requested palette size
+  cv::Mat colors; // BGR, one entry per colour register
+  std::vector<uchar> lut;
+  std::vector<unsigned char> rgb;
+  mutable std::mutex dithers_mutex;
+  mutable std::vector<SixelDitherPtr> dithers;
+};
+
+// The native encoder uses the repo's quantizers; for libsixel its own
+// quantizer picks the registers, as it does for stills.
+std::shared_ptr<const SixelColors>
+buildSixelColors(const cv::Mat &bgr, int paletteSize,
+                 Sakura::SixelQuality quality, Sakura::SixelEncoder encoder,
+                 Sakura::Quantizer quantizer) {
+  auto built = std::make_shared<SixelColors>();
+  built->encoder = encoder;
+  built->quality = quality;
+  built->quantizer = quantizer;
+  built->size = paletteSize;
+  if (encoder == Sakura::NATIVE) {
+    built->colors = buildPalette(bgr, paletteSize, quantizer);
+  } else {
+    cv::Mat rgb_img;
+    cv::cvtColor(bgr, rgb_img, cv::COLOR_BGR2RGB);
+    const SixelDitherPtr dither = newSixelDither(rgb_img, paletteSize, quality);
+    if (!dither)
+      return nullptr;
+    const int n = sixel_dither_get_num_of_palette_colors(dither.get());
+    const unsigned char *registers = sixel_dither_get_palette(dither.get());
+    if (n <= 0 || registers == nullptr)
+      return nullptr;
+    built->colors.create(n, 1, CV_8UC3);
+    for (int i = 0; i < n; ++i) {
+      built->colors.at<cv::Vec3b>(i) = cv::Vec3b(
+          registers[3 * i + 2], registers[3 * i + 1], registers[3 * i]);
+    }
+  }
+  if (built->colors.empty())
+    return nullptr;
+  built->lut = buildInverseColorLut(built->colors);
+  built->rgb.reserve(static_cast<std::size_t>(built->colors.rows) * 3);
+  for (int i = 0; i < built->colors.rows; ++i) {
+    const cv::Vec3b color = built->colors.at<cv::Vec3b>(i);
+    built->rgb.insert(built->rgb.end(), {color[2], color[1], color[0]});
+  }
+  return built;
+}
+
+void appendNumber(std::string &out, int value) {
+  char digits[12];
+  const auto result = std::to_chars(digits, digits + sizeof(digits), value);
+  out.append(digits, static_cast<std::size_t>(result.ptr - digits));
+}
+
+// One six-pixel band: every colour present gets its register selector and
+// its run-length coded sixels up to its rightmost pixel, with graphics
+// carriage returns in between. The sixel bits of all colours are packed in
+// one pass over the band's pixels; a colour's row of bits is cleared only
+// when the colour first appears, so the work is proportional to the pixels
+// plus the output, not to the palette size.
+void encodeSixelBand(const cv::Mat &indices, int y0, std::string &out) {
+  const int rows = std::min(6, indices.rows - y0);
+  const std::size_t width = static_cast<std::size_t>(indices.cols);
+  thread_local std::vector<uchar> bits;
+  if (bits.size() < 256 * width)
+    bits.resize(256 * width);
+  int last[256];
+  std::fill(std::begin(last), std::end(last), -1);
+  for (int r = 0; r < rows; ++r) {
+    const uchar *row = indices.ptr<uchar>(y0 + r);
+    const uchar bit = static_cast<uchar>(1 << r);
+    for (std::size_t x = 0; x < width; ++x) {
+      const uchar color = row[x];
+      uchar *color_bits = bits.data() + color * width;
+      if (last[color] < 0)
+        std::fill_n(color_bits, width, uchar{0});
+      color_bits[x] |= bit;
+      last[color] = std::max(last[color], static_cast<int>(x));
+    }
+  }
+
+  bool first = true;
+  for (int color = 0; color < 256; ++color) {
+    if (last[color] < 0)
+      continue;
+    const uchar *color_bits = bits.data() + color * width;
+    const int end = last[color] + 1;
+
+    if (!first)
+      out += '$';
+    first = false;
+    out += '#';
+    out.append(DECIMAL.text[color], DECIMAL.length[color]);
+    for (int x = 0; x < end;) {
+      const uchar value = color_bits[x];
+      int run = 1;
+      while (x + run < end && color_bits[x + run] == value)
+        ++run;
+      const char sixel = static_cast<char>('?' + value);
+      if (run > 3) {
+        out += '!';
+        appendNumber(out, run);
+        out += sixel;
+      } else {
+        out.append(static_cast<std::size_t>(run), sixel);
+      }
+      x += run;
+    }
+  }
+}
+
+// Appends the SIXEL stream for palette indices: DCS with raster attributes,
+// the colour registers, then the bands, which are encoded in parallel and
+// joined with a single reservation.
+void encodeSixel(const cv::Mat &indices, const cv::Mat &palette, int width,
+                 int height, std::string &out) {
+  const int bands = (indices.rows + 5) / 6;
+  std::vector<std::string> encoded(static_cast<std::size_t>(bands));
+  cv::parallel_for_(cv::Range(0, bands), [&](const cv::Range &range) {
+    for (int band = range.start; band < range.end; ++band) {
+      encodeSixelBand(indices, band * 6, encoded[band]);
+    }
+  });
+
+  // "\x1bP0;1q\"1;1;W;H" plus "#255;2;100;100;100" per register.
+  std::size_t total = 40 + static_cast<std::size_t>(palette.rows) * 18;
+  for (const std::string &band : encoded) {
+    total += band.size() + 1;
+  }
+  out.reserve(out.size() + total + 2);
+
+  const auto percent = [](uchar v) { return (v * 100 + 127) / 255; };
+  out += "\x1bP0;1q\"1;1;";
+  appendNumber(out, width);
+  out += ';';
+  appendNumber(out, height);
+  for (int i = 0; i < palette.rows; ++i) {
+    const cv::Vec3b color = palette.at<cv::Vec3b>(i);
+    const int rgb[3] = {percent(color[2]), percent(color[1]),
+                        percent(color[0])};
+    out += '#';
+    out.append(DECIMAL.text[i], DECIMAL.length[i]);
+    out += ";2";
+    for (int c : rgb) {
+      out += ';';
+      out.append(DECIMAL.text[c], DECIMAL.length[c]);
+    }
+  }
+  for (int band = 0; band < bands; ++band) {
+    if (band > 0)
+      out += '-';
+    out += encoded[band];
+  }
+  out += "\x1b\\";
+}
+
+// Older libsixel versions write no raster attributes, which terminals need
+// to scale the image. They go before the first colour register of the image
+// starting at `start`.
+void insertRasterAttributes(std::string &sixel, std::size_t start, int width,
+                            int height) {
+  if (width <= 0 || height <= 0)
+    return;
+  const std::size_t pos = sixel.find('#', start);
+  if (pos != std::string::npos) {
+    sixel.insert(pos, "\"1;1;" + std::to_string(width) + ";" +
+                          std::to_string(height));
+  }
+}
+
+cv::Mat toBgr(const cv::Mat &img) {
+  cv::Mat bgr;
+  if (img.channels() == 3) {
+    bgr = img;
+  } else if (img.channels() == 4) {
+    cv::cvtColor(img, bgr, cv::COLOR_BGRA2BGR);
+  } else if (img.channels() == 1) {
+    cv::cvtColor(img, bgr, cv::COLOR_GRAY2BGR);
+  }
+  return bgr;
+}
+
+// Encodes `bgr` against a shared palette. Pixels are mapped through the
+// palette's inverse colour map; libsixel receives them as PAL8 through a
+// dither borrowed from the palette's pool, so concurrent encodes never
+// share one. Appends to `out` and leaves it untouched on failure.
+bool encodeSixelWith(const cv::Mat &bgr,
+                     const std::shared_ptr<const SixelColors> &colors,
+                     int output_width, int output_height, std::string &out) {
+  cv::Mat indices;
+  mapToPalette(bgr, colors->lut, indices);
+  const bool sized = output_width > 0 && output_height > 0;
+  if (colors->encoder == Sakura::NATIVE) {
+    encodeSixel(indices, colors->colors, sized ? output_width : bgr.cols,
+                sized ? output_height : bgr.rows, out);
+    return true;
+  }
+
+  SixelDitherPtr dither;
+  {
+    std::lock_guard<std::mutex> lock(colors->dithers_mutex);
+    if (!colors->dithers.empty()) {
+      dither = std::move(colors->dithers.back());
+      colors->dithers.pop_back();
+    }
+  }
+  if (!dither) {
+    sixel_dither_t *raw_dither = nullptr;
+    if (sixel_dither_new(&raw_dither, colors->colors.rows, nullptr) !=
+            SIXEL_OK ||
+        raw_dither == nullptr) {
+      return false;
+    }
+    dither.reset(raw_dither);
+    sixel_dither_set_palette(dither.get(),
+                             const_cast<unsigned char *>(colors->rgb.data()));
+    sixel_dither_set_pixelformat(dither.get(), SIXEL_PIXELFORMAT_PAL8);
+  }
+
+  const std::size_t start = out.size();
+  bool encoded = false;
+  sixel_output_t *raw_output = nullptr;
+  if (sixel_output_new(&raw_output, string_writer, &out, nullptr) ==
+      SIXEL_OK) {
+    const std::unique_ptr<sixel_output_t, SixelOutputDeleter> output(
+        raw_output);
+    encoded = sixel_encode(indices.data, indices.cols, indices.rows, 1,
+                           dither.get(), output.get()) == SIXEL_OK;
+  }
+  {
+    std::lock_guard<std::mutex> lock(colors->dithers_mutex);
+    colors->dithers.push_back(std::move(dither));
+  }
+  if (!encoded) {
+    out.resize(start);
+    return false;
+  }
+  insertRasterAttributes(out, start, output_width, output_height);
+  return true;
+}
+} // namespace
+
+// Palette shared by the frames of one playback when staticPalette is set. It
+// is built from one frame and rebuilt only on a scene cut, when a frame's
+// histogram drifts past the threshold from the one the palette was built
+// from, or when the size, encoder, quality or quantizer asked for differs
+// from what it was built with; every other frame only maps pixels. The
+// palette is published as an immutable shared_ptr and the mutex covers only
+// the rebuild check and the swap, so encodes run in parallel. Workers
+// meeting the same scene cut may each rebuild; the last one published wins.
+// A negative threshold rebuilds on every update.
+struct Sakura::SixelPalette {
+  explicit SixelPalette(double scene_cut_threshold)
+      : scene_cut_threshold(scene_cut_threshold) {}
+
+  std::shared_ptr<const SixelColors> update(const cv::Mat &bgr,
+                                            int paletteSize,
+                                            SixelQuality quality,
+                                            SixelEncoder encoder,
+                                            Quantizer quantizer) {
+    const ColorHistogram histogram = colorHistogram(bgr);
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      if (current && current->size == paletteSize &&
+          current->encoder == encoder && current->quality == quality &&
+          current->quantizer == quantizer &&
+          histogramDistance(histogram, reference) <= scene_cut_threshold) {
+        return current;
+      }
+    }
+    std::shared_ptr<const SixelColors> rebuilt =
+        buildSixelColors(bgr, paletteSize, quality, encoder, quantizer);
+    if (!rebuilt)
+      return nullptr;
+    std::lock_guard<std::mutex> lock(mutex);
+    current = rebuilt;
+    reference = histogram;
+    return rebuilt;
+  }
+
+  const double scene_cut_threshold;
+  std::mutex mutex;
+  std::shared_ptr<const SixelColors> current;
+  ColorHistogram reference{};
+};
+
+std::string Sakura::renderSixel(const cv::Mat &img, int paletteSize,
+                                int output_width, int output_height,
+                                SixelQuality quality,
+                                SixelPalette *palette, SixelEncoder encoder,
+                                Quantizer quantizer) const {
+  std::string output;
+  renderSixel(img, output, paletteSize, output_width, output_height, quality,
+              palette, encoder, quantizer);
+  return output;
+}
+
+// Appends the image to `output`, which is left untouched on failure, so
+// callers can reuse one buffer across images.
+bool Sakura::renderSixel(const cv::Mat &img, std::string &output,
+                         int paletteSize, int output_width, int output_height,
+                         SixelQuality quality, SixelPalette *palette,
+                         SixelEncoder encoder, Quantizer quantizer) const {
+  if (img.empty() || img.cols <= 0 || img.rows <= 0) {
+    return false;
+  }
+
+  // Validate input parameters
+  if (paletteSize <= 0 || paletteSize > 256) {
+    paletteSize = 256; // Fallback to safe value
+  }
+  if (palette != nullptr || encoder == NATIVE) {
+    const cv::Mat bgr = toBgr(img);
+    if (bgr.empty())
+      return false;
+    const std::shared_ptr<const SixelColors> colors =
+        palette != nullptr
+            ? palette->update(bgr, paletteSize, quality, encoder, quantizer)
+            : buildSixelColors(bgr, paletteSize, quality, encoder, quantizer);
+    if (!colors)
+      return false;
+    return encodeSixelWith(bgr, colors, output_width, output_height, output);
+  }
+
+  cv::Mat rgb_img;
+  if (img.channels() == 3) {
+    cv::cvtColor(img, rgb_img, cv::COLOR_BGR2RGB);
+  } else if (img.channels() == 4) {
+    cv::cvtColor(img, rgb_img, cv::COLOR_BGRA2RGB);
+  } else if (img.channels() == 1) {
+    cv::cvtColor(img, rgb_img, cv::COLOR_GRAY2RGB);
+  } else {
+    return false; // Unsupported format
+  }
+
+  // Validate converted image
+  if (rgb_img.empty() || rgb_img.data == nullptr) {
+    return false;
+  }
+
+  const std::size_t start = output.size();
+  output.reserve(start + (quality == HIGH ? 1024 * 1024
+                                          : 512 * 1024)); // Based on quality
+
+  std::unique_ptr<sixel_output_t, SixelOutputDeleter> sixel_output;
+  {
+    sixel_output_t *raw_output = nullptr;
+    if (sixel_output_new(&raw_output, string_writer, &output, nullptr) !=
+        SIXEL_OK) {
+      return false;
+    }
+    sixel_output.reset(raw_output);
+  }
+
+  const SixelDitherPtr dither = newSixelDither(rgb_img, paletteSize, quality);
+  if (!dither) {
+    return false;
+  }
+  if (sixel_encode(rgb_img.data, rgb_img.cols, rgb_img.rows, 3, dither.get(),
+                   sixel_output.get()) != SIXEL_OK) {
+    output.resize(start);
+    return false;
+  }
+
+  insertRasterAttributes(output, start, output_width, output_height);
+  return true;
+}
+
+// Ultra-fast video renderer using direct terminal colors (no SIXEL). Appends
+// the whole frame to `output`; callers reuse the buffer across frames.
+void Sakura::renderVideoUltraFast(const cv::Mat &frame,
+                                  std::string &output) const {
+  if (frame.empty() || frame.channels() != 3) {
+    return;
+  }
+
+  const int height = frame.rows;
+  const int width = frame.cols;
+
+  constexpr std::string_view row_end = "\033[0m\n"; // Reset colors and newline
+
+  AnsiEncoder encoder(output);
+  char *p = encoder.reserve(static_cast<std::size_t>((height + 1) / 2) *
+                            (width * HALF_BLOCK_CELL_BYTES + row_end.size()));
+
+  // Use Unicode block characters for high density rendering
+  for (int y = 0; y < height; y += 2) { // Process 2 rows at a time
+    const cv::Vec3b *top = frame.ptr<cv::Vec3b>(y);
+    const cv::Vec3b *bottom = (y + 1 < height) ? frame.ptr<cv::Vec3b>(y + 1)
+                                               : top;
+    // 24-bit RGB terminal colors, resent only when they change along the row
+    SgrState state;
+    for (int x = 0; x < width; ++x) {
+      p = emitHalfBlockCell(p, top[x], bottom[x], state);
+    }
+    p = AnsiEncoder::text(p, row_end);
+  }
+  encoder.commit(p);
+}
+
+bool Sakura::renderGridFromUrls(const std::vector<std::string> &urls, int cols,
+                                const RenderOptions &options) const {
+  if (urls.empty() || cols <= 0) {
+    std::cerr << "Invalid grid parameters" << std::endl;
+    return false;
+  }
+
+  const int rows = (static_cast<int>(urls.size()) + cols - 1) / cols;
+  const auto [term_width, term_height] = getTerminalSize();
+  const int cell_width = term_width / cols;
+  const int cell_height = term_height / rows;
+
+  const int cells = static_cast<int>(urls.size());
+  RenderOptions cell_options = options;
+  cell_options.width = cell_width;
+  cell_options.height = cell_height;
+
+  // Up to maxConcurrentFetches downloads are in flight; each fetcher decodes
+  // and renders its image as soon as the body arrives. Results land in the
+  // cell's own slot, so the layout does not depend on completion order, and
+  // a failed cell is left blank.
+  std::vector<std::vector<std::string>> cell_lines(cells);
+  std::vector<std::string> errors(cells);
+  std::atomic<int> next_cell{0};
+  const std::string cell_key =
+      outputKey(cell_options, cell_width, cell_height) + " lines";
+  const auto fetch = [&] {
+    for (int i = next_cell++; i < cells; i = next_cell++) {
+      if (options.cache) {
+        // Cached as the cell's lines joined by newlines.
+        std::string joined;
+        const bool loaded = options.cache->fetch(
+            urls[i], cell_key,
+            [&](const cv::Mat &img, std::string &out) {
+              for (const auto &line : renderImageToLines(img, cell_options)) {
+                out += line;
+                out += '\n';
+              }
+              return !out.empty();
+            },
+            joined);
+        if (!loaded) {
+          errors[i] = "Failed to load image: " + urls[i];
+          continue;
+        }
+        std::istringstream lines(joined);
+        for (std::string line; std::getline(lines, line);) {
+          cell_lines[i].push_back(std::move(line));
+        }
+        continue;
+      }
+
+      const auto response = cpr::Get(cpr::Url{urls[i]});
+      if (response.status_code != 200) {
+        errors[i] = "Failed to download image: " + urls[i];
+        continue;
+      }
+
+      const std::vector<uchar> imgData(response.text.begin(),
+                                       response.text.end());
+      const cv::Mat img = cv::imdecode(imgData, cv::IMREAD_COLOR);
+      if (img.empty()) {
+        errors[i] = "Failed to decode image: " + urls[i];
+        continue;
+      }
+      cell_lines[i] = renderImageToLines(img, cell_options);
+    }
+  };
+
+  const int fetchers = std::clamp(options.maxConcurrentFetches, 1, cells);
+  std::vector<std::thread> pool;
+  pool.reserve(fetchers - 1);
+  for (int i = 1; i < fetchers; ++i) {
+    pool.emplace_back(fetch);
+  }
+  fetch();
+  for (auto &thread : pool) {
+    thread.join();
+  }
+
+  for (const std::string &error : errors) {
+    if (!error.empty())
+      std::cerr << error << std::endl;
+  }
+
+  // Each cell line starts with an absolute column move, so short lines and
+  // blank cells cannot shift the cells to their right.
+  std::string out;
+  for (int r = 0; r < rows; ++r) {
+    std::size_t row_height = 0;
+    for (int c = 0; c < cols && r * cols + c < cells; ++c) {
+      row_height = std::max(row_height, cell_lines[r * cols + c].size());
+    }
+    for (std::size_t i = 0; i < row_height; ++i) {
+      for (int c = 0; c < cols && r * cols + c < cells; ++c) {
+        const auto &lines = cell_lines[r * cols + c];
+        if (i < lines.size()) {
+          out += "\033[" + std::to_string(c * cell_width + 1) + "G";
+          out += lines[i];
+        }
+      }
+      out += '\n';
+    }
+  }
+  return outputSink(options)->write(out, FrameInfo{});
+}
+
+namespace {
+bool isUrl(std::string_view input) {
+  return input.rfind("http://", 0) == 0 || input.rfind("https://", 0) == 0;
+}
+
+bool isImageFile(const std::filesystem::path &path) {
+  std::string ext = path.extension().string();
+  std::transform(ext.begin(), ext.end(), ext.begin(),
+                 [](unsigned char c) { return std::tolower(c); });
+  static const char *const IMAGE_EXTENSIONS[] = {
+      ".png", ".jpg", ".jpeg", ".bmp", ".gif", ".webp", ".tif", ".tiff"};
+  return std::find(std::begin(IMAGE_EXTENSIONS), std::end(IMAGE_EXTENSIONS),
+                   ext) != std::end(IMAGE_EXTENSIONS);
+}
+
+// Directories become the images directly inside them, in name order.
+std::vector<std::string> expandBatchInputs(
+    const std::vector<std::string> &inputs) {
+  std::vector<std::string> expanded;
+  for (const std::string &input : inputs) {
+    std::error_code error;
+    if (isUrl(input) || !std::filesystem::is_directory(input, error)) {
+      expanded.push_back(input);
+      continue;
+    }
+    std::vector<std::string> images;
+    for (const auto &entry :
+         std::filesystem::directory_iterator(input, error)) {
+      if (entry.is_regular_file(error) && isImageFile(entry.path()))
+        images.push_back(entry.path().string());
+    }
+    std::sort(images.begin(), images.end());
+    expanded.insert(expanded.end(), images.begin(), images.end());
+  }
+  return expanded;
+}
+
+// Output file per input: its file name stem with the mode's extension, and
+// a counter when the name is already taken. Issued names are tracked as a
+// whole, since a counted name can collide with another input's own stem
+// (a.png, a.jpg and a-1.png).
+std::vector<std::filesystem::path>
+batchOutputPaths(const std::vector<std::string> &inputs,
+                 const std::filesystem::path &directory,
+                 Sakura::RenderMode mode) {
+  const char *extension = mode == Sakura::SIXEL ? ".six" : ".ans";
+  std::unordered_set<std::string> issued;
+  std::unordered_map<std::string, int> next_suffix;
+  std::vector<std::filesystem::path> outputs;
+  outputs.reserve(inputs.size());
+  for (const std::string &input : inputs) {
+    std::string_view name = input;
+    if (isUrl(name))
+      name = name.substr(0, name.find_first_of("?#"));
+    while (!name.empty() && name.back() == '/')
+      name.remove_suffix(1);
+    std::string stem =
+        std::filesystem::path(std::string(name)).filename().stem().string();
+    if (stem.empty())
+      stem = "image";
+    std::string file_stem = stem;
+    int &suffix = next_suffix[stem];
+    while (!issued.insert(file_stem).second)
+      file_stem = stem + "-" + std::to_string(++suffix);
+    outputs.push_back(directory / (file_stem + extension));
+  }
+  return outputs;
+}
+
+// Per-worker deques of item indices. A worker takes from the back of its
+// own deque and, once that is empty, steals from the front of the others,
+// so uneven images (large files, slow servers) do not leave cores idle.
+class WorkStealingQueues {
+public:
+  WorkStealingQueues(std::size_t items, int workers) : queues_(workers) {
+    // Contiguous ranges keep a worker's own items in input order.
+    for (std::size_t i = 0; i < items; ++i)
+      queues_[i * workers / items].items.push_back(i);
+  }
+
+  bool next(int worker, std::size_t &item) {
+    {
+      Queue &own = queues_[worker];
+      std::lock_guard<std::mutex> lock(own.mutex);
+      if (!own.items.empty()) {
+        item = own.items.back();
+        own.items.pop_back();
+        return true;
+      }
+    }
+    const int workers = static_cast<int>(queues_.size());
+    for (int offset = 1; offset < workers; ++offset) {
+      Queue &victim = queues_[(worker + offset) % workers];
+      std::lock_guard<std::mutex> lock(victim.mutex);
+      if (!victim.items.empty()) {
+        item = victim.items.front();
+        victim.items.pop_front();
+        return true;
+      }
+    }
+    return false; // nothing is ever added, so empty everywhere means done
+  }
+
+private:
+  struct Queue {
+    std::mutex mutex;
+    std::deque<std::size_t> items;
+  };
+  std::vector<Queue> queues_;
+};
+} // namespace
+
+Sakura::BatchReport Sakura::renderBatch(const std::vector<std::string> &inputs,
+                                        const std::string &outputDirectory,
+                                        const RenderOptions &options,
+                                        int threads) const {
+  BatchReport report;
+  const std::vector<std::string> images = expandBatchInputs(inputs);
+  std::error_code error;
+  std::filesystem::create_directories(outputDirectory, error);
+  if (images.empty())
+    return report;
+  const std::vector<std::filesystem::path> outputs =
+      batchOutputPaths(images, outputDirectory, options.mode);
+
+  int workers = threads > 0
+                    ? threads
+                    : static_cast<int>(std::thread::hardware_concurrency());
+  workers = std::clamp(workers, 1, static_cast<int>(images.size()));
+  WorkStealingQueues queue(images.size(), workers);
+  std::vector<std::string> errors(images.size());
+  std::atomic<std::size_t> rendered{0};
+
+  // Each worker holds one image and its output at a time, so memory in
+  // flight is bounded by the worker count; the output buffer is reused.
+  const auto start = std::chrono::steady_clock::now();
+  std::vector<std::thread> pool;
+  pool.reserve(workers);
+  for (int w = 0; w < workers; ++w) {
+    pool.emplace_back([&, w] {
+      std::string output;
+      std::size_t i;
+      while (queue.next(w, i)) {
+        const std::string &input = images[i];
+        cv::Mat img;
+        if (isUrl(input)) {
+          const auto response = cpr::Get(cpr::Url{input});
+          if (response.status_code != 200) {
+            errors[i] = "download failed (status " +
+                        std::to_string(response.status_code) + ")";
+            continue;
+          }
+          const std::vector<uchar> data(response.text.begin(),
+                                        response.text.end());
+          img = cv::imdecode(data, cv::IMREAD_COLOR);
+        } else {
+          img = cv::imread(input, cv::IMREAD_COLOR);
+        }
+        if (img.empty()) {
+          errors[i] = "could not decode image";
+          continue;
+        }
+        output.clear();
+        if (!renderToBuffer(img, options, output)) {
+          errors[i] = "render failed";
+        } else if (!writeFileAtomic(outputs[i], output)) {
+          errors[i] = "could not write " + outputs[i].string();
+        } else {
+          ++rendered;
+        }
+      }
+    });
+  }
+  for (auto &worker : pool) {
+    worker.join();
+  }
+
+  report.seconds = std::chrono::duration<double>(
+                       std::chrono::steady_clock::now() - start)
+                       .count();
+  report.rendered = rendered;
+  report.imagesPerSecond =
+      report.seconds > 0.0 ? report.rendered / report.seconds : 0.0;
+  for (std::size_t i = 0; i < images.size(); ++i) {
+    if (!errors[i].empty())
+      report.failures.emplace_back(images[i], std::move(errors[i]));
+  }
+  return report;
+}
+
+namespace {
+// Dirty-tile repaint for SIXEL playback. Each frame is compared with the last
+// one sent, tile by tile, by mean absolute difference per channel; only tiles
+// above the threshold are encoded and drawn at their cell position. Tiles are
+// snapped to whole cells so each one starts on a cell boundary, and their
+// height to whole six-pixel sixel bands so no partial band at a tile's foot
+// can paint over the tile below. All tiles of a frame share one palette, so
+// repainted tiles match the ones left on screen, and the whole frame is
+// resent every `refresh_interval` frames. Frames must be fed in display
+// order.
+class SixelTileEncoder {
+public:
+  SixelTileEncoder(const Sakura::RenderOptions &options,
+                   std::pair<int, int> cell_size)
+      : cell_(cell_size.first, cell_size.second),
+        threshold_(options.tileDiffThreshold),
+        refresh_interval_(options.tileRefreshInterval) {
+    const int tile_cols =
+        std::max(1, (options.tileWidth + cell_.width / 2) / cell_.width);
+    const int band_height = std::lcm(cell_.height, 6);
+    const int tile_bands =
+        std::max(1, (options.tileHeight + band_height / 2) / band_height);
+    tile_ = cv::Size(tile_cols * cell_.width, tile_bands * band_height);
+  }
+
+  // Appends a positioned update for `frame` and returns whether it redrew
+  // the whole frame. `choose_palette(frame)` returns the palette for the
+  // frame and is called once, from the whole frame, before any of its tiles
+  // are encoded.
+  template <typename PaletteFn>
+  bool encode(const cv::Mat &frame, std::string &out,
+              PaletteFn &&choose_palette) {
+    const bool full = previous_.size() != frame.size() ||
+                      previous_.type() != frame.type() ||
+                      (refresh_interval_ > 0 &&
+                       frames_since_refresh_ >= refresh_interval_);
+    if (full) {
+      out += "\x1b[H";
+      out += encodeTile(frame, choose_palette(frame));
+      frame.copyTo(previous_);
+      frames_since_refresh_ = 1;
+      return true;
+    }
+    ++frames_since_refresh_;
+
+    dirty_.clear();
+    for (int y = 0; y < frame.rows; y += tile_.height) {
+      for (int x = 0; x < frame.cols; x += tile_.width) {
+        const cv::Rect roi(x, y, std::min(tile_.width, frame.cols - x),
+                           std::min(tile_.height, frame.rows - y));
+        cv::absdiff(frame(roi), previous_(roi), diff_);
+        const cv::Scalar mad = cv::mean(diff_);
+        if (std::max({mad[0], mad[1], mad[2], mad[3]}) > threshold_) {
+          dirty_.push_back(roi);
+        }
+      }
+    }
+    if (dirty_.empty())
+      return false;
+
+    const std::shared_ptr<const SixelColors> colors = choose_palette(frame);
+    tiles_.resize(dirty_.size());
+    cv::parallel_for_(cv::Range(0, static_cast<int>(dirty_.size())),
+                      [&](const cv::Range &range) {
+                        for (int i = range.start; i < range.end; ++i) {
+                          tiles_[i] = encodeTile(frame(dirty_[i]), colors);
+                        }
+                      });
+
+    for (std::size_t i = 0; i < dirty_.size(); ++i) {
+      const cv::Rect &roi = dirty_[i];
+      char cursor[AnsiEncoder::MAX_CURSOR_BYTES];
+      const char *end = AnsiEncoder::cursorTo(cursor, roi.y / cell_.height,
+                                              roi.x / cell_.width);
+      out.append(cursor, static_cast<std::size_t>(end - cursor));
+      out += tiles_[i];
+      cv::Mat target = previous_(roi);
+      frame(roi).copyTo(target);
+    }
+    return false;
+  }
+
+private:
+  static std::string
+  encodeTile(const cv::Mat &region,
+             const std::shared_ptr<const SixelColors> &colors) {
+    std::string out;
+    if (colors)
+      encodeSixelWith(toBgr(region), colors, region.cols, region.rows, out);
+    return out;
+  }
+
+  cv::Size cell_;
+  cv::Size tile_;
+  const double threshold_;
+  const int refresh_interval_;
+  int frames_since_refresh_ = 0;
+  cv::Mat previous_;
+  cv::Mat diff_;
+  std::vector<cv::Rect> dirty_;
+  std::vector<std::string> tiles_;
+};
+
+// Closed-loop quality control for playback. The writer reports every frame in
+// display order; over a sliding window of about a second the mean parallel
+// encode time and the mean writer-thread time (serial encode plus terminal
+// write) are compared with the frame budget. While frames run late the
+// palette shrinks first, then the output scale; with headroom the scale
+// recovers first, then the palette. The window restarts after each change so
+// every decision sees only frames produced with the current settings.
+// Settings are read lock-free by the encoders.
+class QualityController {
+public:
+  QualityController(const Sakura::RenderOptions &options, double fps,
+                    int encode_parallelism, bool palette_applies)
+      : adapt_palette_(options.adaptivePalette && palette_applies),
+        adapt_scale_(options.adaptiveScale),
+        min_palette_(std::clamp(options.minPaletteSize, 2, 256)),
+        max_palette_(std::clamp(options.maxPaletteSize, min_palette_, 256)),
+        min_scale_(std::clamp(options.minScaleFactor, 0.05, 1.0)),
+        max_scale_(std::clamp(options.maxScaleFactor, min_scale_, 1.0)),
+        scale_step_(options.scaleStep > 0.0 ? options.scaleStep : 0.05),
+        budget_ms_(1000.0 / fps),
+        encode_parallelism_(std::max(1, encode_parallelism)),
+        window_(std::max<std::size_t>(10, static_cast<std::size_t>(fps))),
+        on_change_(options.onQualityChange),
+        palette_(adapt_palette_ ? std::clamp(options.paletteSize, min_palette_,
+                                             max_palette_)
+                                : options.paletteSize),
+        scale_(adapt_scale_ ? max_scale_ : 1.0) {}
+
+  bool enabled() const noexcept { return adapt_palette_ || adapt_scale_; }
+  int paletteSize() const noexcept {
+    return palette_.load(std::memory_order_relaxed);
+  }
+  double scaleFactor() const noexcept {
+    return scale_.load(std::memory_order_relaxed);
+  }
+  int adjustments() const noexcept { return adjustments_; }
+
+  // `encode` ran on the worker pool, `serial` on the writer thread.
+  void record(long long frame, std::chrono::nanoseconds encode,
+              std::chrono::nanoseconds serial, bool late) {
+    if (!enabled())
+      return;
+    encode_ms_ += std::chrono::duration<double, std::milli>(encode).count();
+    serial_ms_ += std::chrono::duration<double, std::milli>(serial).count();
+    late_ += late ? 1 : 0;
+    if (++samples_ < window_)
+      return;
+
+    const double n = static_cast<double>(samples_);
+    Sakura::QualityEvent event;
+    event.frame = frame;
+    event.encodeLoad = encode_ms_ / n / (budget_ms_ * encode_parallelism_);
+    event.writeLoad = serial_ms_ / n / budget_ms_;
+    event.lateRatio = late_ / n;
+    samples_ = 0;
+    late_ = 0;
+    encode_ms_ = serial_ms_ = 0.0;
+
+    const double load = std::max(event.encodeLoad, event.writeLoad);
+    bool changed = false;
+    if (event.lateRatio > 0.05 || load > 0.9) {
+      changed = stepDown();
+    } else if (event.lateRatio == 0.0 && load < 0.6) {
+      changed = stepUp();
+    }
+    if (!changed)
+      return;
+
+    ++adjustments_;
+    event.paletteSize = paletteSize();
+    event.scaleFactor = scaleFactor();
+    if (on_change_)
+      on_change_(event);
+  }
+
+private:
+  bool stepDown() {
+    const int palette = paletteSize();
+    if (adapt_palette_ && palette > min_palette_) {
+      palette_.store(std::max(min_palette_, palette / 2));
+      return true;
+    }
+    const double scale = scaleFactor();
+    if (adapt_scale_ && scale > min_scale_) {
+      scale_.store(std::max(min_scale_, scale - scale_step_));
+      return true;
+    }
+    return false;
+  }
+
+  bool stepUp() {
+    const double scale = scaleFactor();
+    if (adapt_scale_ && scale < max_scale_) {
+      scale_.store(std::min(max_scale_, scale + scale_step_));
+      return true;
+    }
+    const int palette = paletteSize();
+    if (adapt_palette_ && palette < max_palette_) {
+      palette_.store(std::min(max_palette_, palette * 2));
+      return true;
+    }
+    return false;
+  }
+
+  const bool adapt_palette_;
+  const bool adapt_scale_;
+  const int min_palette_;
+  const int max_palette_;
+  const double min_scale_;
+  const double max_scale_;
+  const double scale_step_;
+  const double budget_ms_;
+  const int encode_parallelism_;
+  const std::size_t window_;
+  const std::function<void(const Sakura::QualityEvent &)> on_change_;
+
+  std::atomic<int> palette_;
+  std::atomic<double> scale_;
+
+  std::size_t samples_ = 0;
+  int late_ = 0;
+  double encode_ms_ = 0.0;
+  double serial_ms_ = 0.0;
+  int adjustments_ = 0;
+};
+
+// Chooses the source frames shown when targetFps is below the source rate.
+// Source frame i is kept when floor(i * target / source) advances, which spaces
+// kept frames evenly and deterministically (60 -> 24 fps keeps 2 of every 5).
+// Skipped frames should only be grab()bed, never retrieved or scaled.
+class FrameDecimator {
+public:
+  FrameDecimator(double source_fps, double target_fps)
+      : ratio_(target_fps > 0.0 && target_fps < source_fps
+                   ? target_fps / source_fps
+                   : 1.0),
+        output_fps_(source_fps * ratio_) {}
+
+  double outputFps() const noexcept { return output_fps_; }
+
+  bool keep(long long source_index) const noexcept {
+    return ratio_ >= 1.0 || source_index == 0 ||
+           outputIndex(source_index) != outputIndex(source_index - 1);
+  }
+
+  // Position of a kept source frame in the output sequence.
+  long long outputIndex(long long source_index) const noexcept {
+    if (ratio_ >= 1.0)
+      return source_index;
+    return static_cast<long long>(
+        std::floor(static_cast<long double>(source_index) * ratio_ + 1e-9L));
+  }
+
+private:
+  const double ratio_;
+  const double output_fps_;
+};
+
+// Scales a target size by the controller's factor; cell renderers keep an even
+// pixel height so both halves of every cell exist.
+cv::Size scaledTargetSize(int width, int height, double scale, bool sixel) {
+  const int w = std::max(1, static_cast<int>(std::lround(width * scale)));
+  const int h = std::max(1, static_cast<int>(std::lround(height * scale)));
+  return sixel ? cv::Size(w, h) : cv::Size(w, h * 2);
+}
+} // namespace
+
+bool Sakura::renderGifFromUrl(std::string_view gifUrl,
+                              const RenderOptions &options) const {
+  cv::VideoCapture cap{std::string(gifUrl)};
+  if (!cap.isOpened()) {
+    std::cerr << "Failed to open GIF" << std::endl;
+    return false;
+  }
+
+  const int gif_width = static_cast<int>(cap.get(cv::CAP_PROP_FRAME_WIDTH));
+  const int gif_height = static_cast<int>(cap.get(cv::CAP_PROP_FRAME_HEIGHT));
+  double source_fps = cap.get(cv::CAP_PROP_FPS);
+  if (source_fps <= 0)
+    source_fps = 10.0; // Default GIF speed
+  const FrameDecimator decimator(source_fps, options.targetFps);
+  const double fps = decimator.outputFps();
+
+  RenderOptions gifOptions = options;
+  gifOptions.mode = SIXEL; // GIFs always play as SIXEL
+  const FitGeometry fit = fitGeometry(cv::Size(gif_width, gif_height),
+                                      options.width, options.height,
+                                      gifOptions);
+  gifOptions.width = fit.width;
+  gifOptions.height = fit.height;
+  const cv::Mat lut = colourAdjustLut(options.contrast, options.brightness);
+
+  if (fps > 20.0) {
+    gifOptions.width = static_cast<int>(gifOptions.width * 0.95);
+    gifOptions.height = static_cast<int>(gifOptions.height * 0.95);
+  }
+
+  const auto frame_duration = std::chrono::duration_cast<
+      std::chrono::steady_clock::duration>(
+      std::chrono::duration<double>(1.0 / fps));
+  const double source_frame_ms = 1000.0 / source_fps;
+
+  int frame_number = 0;
+  int frames_dropped = 0;
+
+  const std::shared_ptr<OutputSink> sink = outputSink(options);
+  sink->write("\033[2J\033[?25l", CONTROL_WRITE);
+
+  cv::Mat frame, resized_frame, scratch;
+  QualityController quality(gifOptions, fps, 1, true);
+
+  std::unique_ptr<SixelTileEncoder> tiles;
+  if (gifOptions.tileUpdates) {
+    tiles = std::make_unique<SixelTileEncoder>(gifOptions,
+                                               getTerminalCellSize());
+  }
+  std::unique_ptr<SixelPalette> palette;
+  if (gifOptions.staticPalette) {
+    palette = std::make_unique<SixelPalette>(gifOptions.sceneCutThreshold);
+  }
+  // Without a static palette every frame gets its own, shared by its tiles.
+  SixelPalette frame_palette(-1.0);
+  const auto choose_palette = [&](const cv::Mat &image) {
+    return (palette ? palette.get() : &frame_palette)
+        ->update(toBgr(image), quality.paletteSize(), gifOptions.sixelQuality,
+                 gifOptions.sixelEncoder, gifOptions.quantizer);
+  };
+  cv::Size last_size;
+
+  Telemetry *telemetry = options.collectStats ? telemetry_.get() : nullptr;
+  const auto record = [telemetry](Stage stage,
+                                  std::chrono::steady_clock::time_point since) {
+    if (telemetry)
+      telemetry->record(stage, std::chrono::steady_clock::now() - since);
+  };
+  TerminalWriter terminal(*sink, options.outputBuffers,
+                          [telemetry](std::chrono::nanoseconds elapsed) {
+                            if (telemetry)
+                              telemetry->record(WRITE, elapsed);
+                          });
+  // Waits until a frame is due and returns its FrameInfo. The caller then
+  // hands the frame to the terminal writer, so the next frame is decoded and
+  // encoded while this one is written.
+  long long frames_shown = 0;
+  double played_ms = 0.0; // length of the loops already played
+  const auto present = [&](std::chrono::steady_clock::time_point due,
+                           double time_ms) {
+    const auto slack_start = std::chrono::steady_clock::now();
+    std::this_thread::sleep_until(due);
+    record(SLACK, slack_start);
+    FrameInfo info;
+    info.index = frames_shown++;
+    info.pts = (played_ms + time_ms) / 1000.0;
+    info.delta = tiles != nullptr;
+    if (telemetry)
+      ++telemetry->displayed;
+    return info;
+  };
+  if (telemetry) {
+    telemetry->reset();
+    telemetry->startReporter(options.statsFile, options.statsInterval);
+  }
+
+  // When looping, the first pass records exactly what it wrote for each
+  // frame, and when, so later loops replay it without decoding or encoding.
+  // If the recording outgrows gifCacheBytes it is dropped and every loop
+  // decodes again. Replayed frames are lent to the writer uncopied; the
+  // writer is closed before the recording goes away.
+  struct RecordedFrame {
+    std::string output;
+    double time_ms; // since the start of the loop
+  };
+  std::vector<RecordedFrame> recording;
+  std::size_t recording_bytes = 0;
+  bool recorded = options.gifLoops != 1;
+  double loop_ms = 0.0;
+
+  for (int loop = 0;
+       terminal.ok() && (options.gifLoops <= 0 || loop < options.gifLoops);
+       ++loop, played_ms += loop_ms) {
+    const auto loop_start = std::chrono::steady_clock::now();
+    const auto due_at = [&](double time_ms) {
+      return loop_start +
+             std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                 std::chrono::duration<double, std::milli>(time_ms));
+    };
+
+    if (loop > 0 && recorded) {
+      if (recording.empty())
+        break;
+      for (const RecordedFrame &cached : recording) {
+        if (!terminal.ok())
+          break;
+        terminal.submitBorrowed(
+            cached.output, present(due_at(cached.time_ms), cached.time_ms));
+      }
+      std::this_thread::sleep_until(due_at(loop_ms));
+      continue;
+    }
+    if (loop > 0 && !cap.open(std::string(gifUrl))) {
+      break;
+    }
+
+    // Display time of the last grabbed frame. GIF frames carry their own
+    // delays; backends that report no timestamps fall back to the nominal
+    // rate.
+    double first_ms = 0.0;
+    double time_ms = 0.0;
+    const auto grab = [&](long long source_index) {
+      if (!cap.grab())
+        return false;
+      const double position = cap.get(cv::CAP_PROP_POS_MSEC);
+      if (source_index == 0) {
+        first_ms = position;
+        time_ms = 0.0;
+      } else if (position - first_ms > time_ms) {
+        time_ms = position - first_ms;
+      } else {
+        time_ms += source_frame_ms;
+      }
+      return true;
+    };
+
+    long long source_index = 0;
+    for (; terminal.ok(); ++source_index) {
+      const auto decode_start = std::chrono::steady_clock::now();
+      if (!grab(source_index))
+        break;
+      if (!decimator.keep(source_index))
+        continue;
+
+      // Far enough behind to skip the frame: it is grabbed but never
+      // retrieved or encoded.
+      const auto due = due_at(time_ms);
+      const auto frame_start = std::chrono::steady_clock::now();
+      if (frame_start - due > 2 * frame_duration &&
+          frames_dropped < frame_number * 0.3) {
+        quality.record(frame_number, {}, {}, true);
+        frame_number++;
+        frames_dropped++;
+        if (telemetry)
+          ++telemetry->dropped;
+        continue;
+      }
+
+      if (!cap.retrieve(frame))
+        break;
+      record(DECODE, decode_start);
+
+      const cv::Size target_size =
+          scaledTargetSize(gifOptions.width, gifOptions.height,
+                           quality.scaleFactor(), true);
+      scaleAndAdjust(frame(fit.source & cv::Rect(cv::Point(), frame.size())),
+                     target_size, cv::INTER_NEAREST, lut, resized_frame,
+                     scratch, telemetry);
+      const auto encode_start = std::chrono::steady_clock::now();
+      std::string sixel_data = terminal.acquire();
+      if (last_size.area() > 0 && target_size != last_size) {
+        sixel_data = "\033[2J"; // Clear what a larger frame left behind
+      }
+      last_size = target_size;
+
+      if (tiles) {
+        tiles->encode(resized_frame, sixel_data, choose_palette);
+      } else {
+        sixel_data += "\033[H";
+        renderSixel(resized_frame, sixel_data, quality.paletteSize(),
+                    target_size.width, target_size.height,
+                    gifOptions.sixelQuality, palette.get(),
+                    gifOptions.sixelEncoder, gifOptions.quantizer);
+      }
+      const auto encoded = std::chrono::steady_clock::now();
+      if (telemetry)
+        telemetry->record(ENCODE, encoded - encode_start);
+
+      if (recorded) {
+        recording_bytes += sixel_data.size();
+        if (recording_bytes > options.gifCacheBytes) {
+          recorded = false;
+          recording = {};
+        } else {
+          recording.push_back({sixel_data, time_ms});
+        }
+      }
+
+      terminal.submit(std::move(sixel_data), present(due, time_ms));
+      const auto now = std::chrono::steady_clock::now();
+      // Writes finish on the writer thread; their time since the last frame
+      // counts against the budget alongside encoding.
+      quality.record(frame_number, {},
+                     encoded - frame_start + terminal.takeWriteTime(),
+                     now > due + frame_duration);
+      frame_number++;
+    }
+
+    // OpenCV does not report the last frame's delay; assume the nominal one.
+    loop_ms = time_ms + source_frame_ms;
+    if (source_index == 0)
+      break; // nothing could be decoded
+    std::this_thread::sleep_until(due_at(loop_ms));
+  }
+
+  terminal.close();
+  if (telemetry)
+    telemetry->stopReporter();
+  sink->write("\033[?25h", CONTROL_WRITE);
+
+  cap.release();
+  return terminal.ok();
+}
+
+bool Sakura::renderVideoFromUrl(std::string_view videoUrl,
+                                const RenderOptions &options) const {
+  // FFmpeg reads http(s) progressively, so playback starts as soon as the
+  // pipeline has prebuffered rather than after the whole download. The
+  // audio player and the ffmpeg pipe open the URL themselves, so a clip
+  // with sound is fetched twice; playAudio = false keeps it to one.
+  std::ostream &status = statusStream(options);
+  status << "Streaming video: " << videoUrl << std::endl;
+  cv::VideoCapture cap;
+  cap.open(std::string(videoUrl), cv::CAP_FFMPEG);
+  if (cap.isOpened()) {
+    return playVideo(cap, videoUrl, options);
+  }
+
+  // Capture backends without network input get the download spooled to
+  // disk as it arrives, never held in memory.
+  std::cerr << "Capture backend cannot stream URLs, downloading first"
+            << std::endl;
+  std::error_code error;
+  std::filesystem::path directory =
+      std::filesystem::temp_directory_path(error);
+  if (error)
+    directory = ".";
+  const std::string tempFile =
+      createUniqueFile((directory / "sakura_video_").string());
+  if (tempFile.empty()) {
+    std::cerr << "Failed to create a temporary file in " << directory
+              << std::endl;
+    return false;
+  }
+  std::ofstream file(tempFile, std::ios::binary | std::ios::trunc);
+  if (!file) {
+    std::cerr << "Failed to open " << tempFile << std::endl;
+    std::remove(tempFile.c_str());
+    return false;
+  }
+  bool write_failed = false;
+  const auto response = cpr::Get(
+      cpr::Url{std::string(videoUrl)},
+      cpr::WriteCallback{[&file, &write_failed](const auto &data, intptr_t) {
+        file.write(data.data(), static_cast<std::streamsize>(data.size()));
+        write_failed = !file;
+        return !write_failed;
+      }});
+  file.close();
+  if (write_failed || !file) {
+    std::cerr << "Failed to write the download to " << tempFile << std::endl;
+    std::remove(tempFile.c_str());
+    return false;
+  }
+  if (response.status_code != 200) {
+    std::cerr << "Failed to download video. Status: " << response.status_code
+              << std::endl;
+    std::remove(tempFile.c_str());
+    return false;
+  }
+
+  const bool result = renderVideoFromFile(tempFile, options);
+
+  std::remove(tempFile.c_str());
+  return result;
+}
+
+namespace {
+// Blocking FIFO with a fixed capacity that joins the playback stages. Once
+// closed, push() fails and pop() drains the remaining items before failing.
+template <typename T> class BoundedQueue {
+public:
+  explicit BoundedQueue(std::size_t capacity)
+      : capacity_(std::max<std::size_t>(capacity, 1)) {}
+
+  bool push(T item) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    not_full_.wait(lock,
+                   [this] { return closed_ || items_.size() < capacity_; });
+    if (closed_)
+      return false;
+    items_.push_back(std::move(item));
+    not_empty_.notify_one();
+    return true;
+  }
+
+  bool pop(T &item) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    not_empty_.wait(lock, [this] { return closed_ || !items_.empty(); });
+    if (items_.empty())
+      return false;
+    item = std::move(items_.front());
+    items_.pop_front();
+    not_full_.notify_one();
+    return true;
+  }
+
+  void close() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    closed_ = true;
+    not_empty_.notify_all();
+    not_full_.notify_all();
+  }
+
+private:
+  const std::size_t capacity_;
+  std::deque<T> items_;
+  bool closed_ = false;
+  std::mutex mutex_;
+  std::condition_variable not_empty_;
+  std::condition_variable not_full_;
+};
+
+struct VideoFrame {
+  long long index = 0;
+  cv::Mat image;
+  std::string payload;
+  cv::Size size; // output geometry the frame was scaled to
+  std::chrono::nanoseconds encode_time{0};
+};
+
+// Recycles decoded frame buffers so sources can decode straight into memory
+// that is already mapped. Buffers of the wrong geometry are simply dropped.
+class MatPool {
+public:
+  cv::Mat acquire(cv::Size size, int type) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    while (!free_.empty()) {
+      cv::Mat mat = std::move(free_.back());
+      free_.pop_back();
+      if (mat.size() == size && mat.type() == type)
+        return mat;
+    }
+    return cv::Mat(size, type);
+  }
+
+  void release(cv::Mat mat) {
+    if (mat.empty())
+      return;
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (free_.size() < MAX_FREE)
+      free_.push_back(std::move(mat));
+  }
+
+private:
+  static constexpr std::size_t MAX_FREE = 64;
+  std::vector<cv::Mat> free_;
+  std::mutex mutex_;
+};
+
+// Where the playback decoder thread gets its frames from.
+class FrameSource {
+public:
+  virtual ~FrameSource() = default;
+  // Skips one frame without producing pixels.
+  virtual bool grab() = 0;
+  virtual bool read(cv::Mat &frame) = 0;
+};
+
+class CaptureFrameSource : public FrameSource {
+public:
+  CaptureFrameSource(cv::VideoCapture &cap, MatPool &pool)
+      : cap_(cap), pool_(pool) {
+    size_ = cv::Size(static_cast<int>(cap_.get(cv::CAP_PROP_FRAME_WIDTH)),
+                     static_cast<int>(cap_.get(cv::CAP_PROP_FRAME_HEIGHT)));
+  }
+
+  bool grab() override { return cap_.grab(); }
+
+  bool read(cv::Mat &frame) override {
+    // A pooled buffer of the right size makes retrieve() write in place.
+    frame = pool_.acquire(size_, CV_8UC3);
+    if (!cap_.read(frame) || frame.empty())
+      return false;
+    size_ = frame.size();
+    return true;
+  }
+
+private:
+  cv::VideoCapture &cap_;
+  MatPool &pool_;
+  cv::Size size_;
+};
+
+#ifndef _WIN32
+bool findExecutable(const std::string &name) {
+  const char *path = std::getenv("PATH");
+  if (path == nullptr)
+    return false;
+  std::string_view dirs(path);
+  while (!dirs.empty()) {
+    const std::size_t end = std::min(dirs.find(':'), dirs.size());
+    std::string candidate(dirs.substr(0, end));
+    candidate += '/';
+    candidate += name;
+    if (end > 0 && access(candidate.c_str(), X_OK) == 0)
+      return true;
+    dirs.remove_prefix(std::min(end + 1, dirs.size()));
   }
+  return false;
+}
 
-  // Validate converted image
-  if (rgb_img.empty() || rgb_img.data == nullptr) {
-    return "";
+// Reads exactly `size` bytes unless the pipe hits EOF or an error first.
+bool readFully(int fd, void *data, std::size_t size) {
+  auto *out = static_cast<char *>(data);
+  while (size > 0) {
+    const ssize_t n = ::read(fd, out, size);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return false;
+    out += n;
+    size -= static_cast<std::size_t>(n);
   }
+  return true;
+}
 
-  std::string sixel_output_string;
-  sixel_output_string.reserve(
-      quality == HIGH ? 1024 * 1024
-                      : 512 * 1024); // Pre-allocate based on quality
+// A child process started from PATH, owned by us: its pid is known, so it
+// can be stopped without touching unrelated processes. Streams that are not
+// piped are connected to /dev/null.
+class Subprocess {
+public:
+  Subprocess() = default;
+  Subprocess(const Subprocess &) = delete;
+  Subprocess &operator=(const Subprocess &) = delete;
+  ~Subprocess() { terminate(); }
 
-  // Use RAII for sixel resources
-  struct SixelOutputDeleter {
-    void operator()(sixel_output_t *p) const {
-      if (p)
-        sixel_output_unref(p);
+  bool start(const std::vector<std::string> &args, bool pipe_stdin,
+             bool pipe_stdout, bool pipe_stderr) {
+    int in[2] = {-1, -1}, out[2] = {-1, -1}, err[2] = {-1, -1};
+    const auto close_all = [&] {
+      for (int fd : {in[0], in[1], out[0], out[1], err[0], err[1]}) {
+        if (fd >= 0)
+          ::close(fd);
+      }
+    };
+    if ((pipe_stdin && ::pipe(in) != 0) || (pipe_stdout && ::pipe(out) != 0) ||
+        (pipe_stderr && ::pipe(err) != 0)) {
+      close_all();
+      return false;
     }
-  };
-  struct SixelDitherDeleter {
-    void operator()(sixel_dither_t *p) const {
-      if (p)
-        sixel_dither_unref(p);
+
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    const auto redirect = [&](int pipe_fd, int target, int flags) {
+      if (pipe_fd >= 0) {
+        posix_spawn_file_actions_adddup2(&actions, pipe_fd, target);
+      } else {
+        posix_spawn_file_actions_addopen(&actions, target, "/dev/null", flags,
+                                         0);
+      }
+    };
+    redirect(in[0], STDIN_FILENO, O_RDONLY);
+    redirect(out[1], STDOUT_FILENO, O_WRONLY);
+    redirect(err[1], STDERR_FILENO, O_WRONLY);
+    for (int fd : {in[0], in[1], out[0], out[1], err[0], err[1]}) {
+      if (fd > STDERR_FILENO)
+        posix_spawn_file_actions_addclose(&actions, fd);
     }
-  };
 
-  std::unique_ptr<sixel_output_t, SixelOutputDeleter> output;
-  std::unique_ptr<sixel_dither_t, SixelDitherDeleter> dither;
+    std::vector<char *> argv;
+    argv.reserve(args.size() + 1);
+    for (const auto &arg : args) {
+      argv.push_back(const_cast<char *>(arg.c_str()));
+    }
+    argv.push_back(nullptr);
 
-  {
-    sixel_output_t *raw_output = nullptr;
-    if (sixel_output_new(&raw_output, string_writer, &sixel_output_string,
-                         nullptr) != SIXEL_OK) {
-      return "";
+    const int spawned = posix_spawnp(&pid_, argv[0], &actions, nullptr,
+                                     argv.data(), environ);
+    posix_spawn_file_actions_destroy(&actions);
+    if (spawned != 0) {
+      pid_ = -1;
+      close_all();
+      return false;
     }
-    output.reset(raw_output);
-  }
 
-  {
-    sixel_dither_t *raw_dither = nullptr;
-    if (sixel_dither_new(&raw_dither, paletteSize, nullptr) != SIXEL_OK ||
-        raw_dither == nullptr) {
-      return "";
+    // Keep only our ends, and keep them out of later children.
+    for (int fd : {in[0], out[1], err[1]}) {
+      if (fd >= 0)
+        ::close(fd);
     }
-    dither.reset(raw_dither);
+    stdin_ = in[1];
+    stdout_ = out[0];
+    stderr_ = err[0];
+    for (int fd : {stdin_, stdout_, stderr_}) {
+      if (fd >= 0)
+        ::fcntl(fd, F_SETFD, FD_CLOEXEC);
+    }
+    return true;
   }
 
-  int sixel_quality_mode =
-      (quality == HIGH) ? SIXEL_QUALITY_HIGH : SIXEL_QUALITY_LOW;
+  int stdinFd() const noexcept { return stdin_; }
+  int stdoutFd() const noexcept { return stdout_; }
+  int stderrFd() const noexcept { return stderr_; }
 
-  if (sixel_dither_initialize(dither.get(), rgb_img.data, rgb_img.cols,
-                              rgb_img.rows, SIXEL_PIXELFORMAT_RGB888,
-                              SIXEL_LARGE_AUTO, SIXEL_REP_CENTER_BOX,
-                              sixel_quality_mode) != SIXEL_OK) {
-    return "";
+  void closeStdin() {
+    if (stdin_ >= 0) {
+      ::close(stdin_);
+      stdin_ = -1;
+    }
   }
 
-  if (sixel_encode(rgb_img.data, rgb_img.cols, rgb_img.rows, 3, dither.get(),
-                   output.get()) != SIXEL_OK) {
-    return "";
+  // Asks the child to stop but keeps our pipe ends open, so a thread blocked
+  // reading one sees EOF instead of a descriptor closed under it.
+  void interrupt() {
+    if (pid_ > 0)
+      ::kill(pid_, SIGTERM);
   }
 
-  // Manually insert raster attributes for older libsixel versions to support
-  // scaling.
-  if (output_width > 0 && output_height > 0) {
-    // The sixel data starts with DCS 'q', then raster attributes, then palette.
-    // We find the palette start '#' and insert the raster attributes before it.
-    // The format is "pan;pad;ph;pv
-    size_t pos = sixel_output_string.find('#');
-    if (pos != std::string::npos) {
-      std::string raster_attrs =
-          "\"" + std::to_string(1) + ";" + std::to_string(1) + ";" +
-          std::to_string(output_width) + ";" + std::to_string(output_height);
-      sixel_output_string.insert(pos, raster_attrs);
+  // Closes our pipe ends, asks the child to stop and reaps it.
+  void terminate() {
+    closeStdin();
+    for (int *fd : {&stdout_, &stderr_}) {
+      if (*fd >= 0) {
+        ::close(*fd);
+        *fd = -1;
+      }
+    }
+    if (pid_ > 0) {
+      ::kill(pid_, SIGTERM);
+      int status = 0;
+      while (::waitpid(pid_, &status, 0) < 0 && errno == EINTR) {
+      }
+      pid_ = -1;
     }
   }
 
-  return sixel_output_string;
-}
+private:
+  pid_t pid_ = -1;
+  int stdin_ = -1;
+  int stdout_ = -1;
+  int stderr_ = -1;
+};
 
-// Ultra-fast video renderer using direct terminal colors (no SIXEL)
-std::string Sakura::renderVideoUltraFast(const cv::Mat &frame) const {
-  if (frame.empty() || frame.channels() != 3) {
-    return "";
-  }
+// Decodes through an ffmpeg child with `-hwaccel auto`. Scaling (and frame
+// rate decimation) happens inside ffmpeg, so only target-size rawvideo BGR24
+// frames cross the pipe; each is read straight into a pooled cv::Mat.
+class FfmpegFrameSource : public FrameSource {
+public:
+  FfmpegFrameSource(cv::Size size, MatPool &pool) : size_(size), pool_(pool) {}
 
-  const int height = frame.rows;
-  const int width = frame.cols;
+  // Starts ffmpeg and waits for the first frame, so a missing binary or an
+  // unsupported input is reported before playback commits to this source.
+  // An empty crop keeps the whole source frame.
+  bool open(std::string_view path, double output_fps, bool decimate,
+            bool fast_resize, const cv::Rect &crop) {
+    if (!findExecutable("ffmpeg"))
+      return false;
 
-  std::string output;
-  output.reserve(height * width * 25); // Pre-allocate for speed
+    std::string filters;
+    if (decimate) {
+      filters = "fps=" + std::to_string(output_fps) + ",";
+    }
+    if (crop.area() > 0) {
+      filters += "crop=" + std::to_string(crop.width) + ":" +
+                 std::to_string(crop.height) + ":" + std::to_string(crop.x) +
+                 ":" + std::to_string(crop.y) + ",";
+    }
+    filters += "scale=" + std::to_string(size_.width) + ":" +
+               std::to_string(size_.height) +
+               (fast_resize ? ":flags=neighbor" : ":flags=area");
 
-  // Use Unicode block characters for high density rendering
-  for (int y = 0; y < height; y += 2) { // Process 2 rows at a time
-    for (int x = 0; x < width; ++x) {
-      const cv::Vec3b top_pixel = frame.at<cv::Vec3b>(y, x);
-      const cv::Vec3b bottom_pixel =
-          (y + 1 < height) ? frame.at<cv::Vec3b>(y + 1, x) : top_pixel;
+    const std::vector<std::string> args = {
+        "ffmpeg", "-hide_banner", "-loglevel", "error", "-nostdin",
+        "-hwaccel", "auto", "-i", std::string(path), "-an", "-sn",
+        "-vf", filters, "-f", "rawvideo", "-pix_fmt", "bgr24", "-"};
+    if (!process_.start(args, false, true, false))
+      return false;
 
-      // Use 24-bit RGB terminal colors
-      output += "\033[48;2;" + std::to_string(bottom_pixel[2]) + ";" +
-                std::to_string(bottom_pixel[1]) + ";" +
-                std::to_string(bottom_pixel[0]) + "m\033[38;2;" +
-                std::to_string(top_pixel[2]) + ";" +
-                std::to_string(top_pixel[1]) + ";" +
-                std::to_string(top_pixel[0]) + "m▀";
+    if (!readFrame(first_)) {
+      process_.terminate();
+      return false;
     }
-    output += "\033[0m\n"; // Reset colors and newline
+    return true;
   }
 
-  return output;
-}
+  bool grab() override {
+    cv::Mat discard;
+    if (!read(discard))
+      return false;
+    pool_.release(std::move(discard));
+    return true;
+  }
 
-bool Sakura::renderGridFromUrls(const std::vector<std::string> &urls, int cols,
-                                const RenderOptions &options) const {
-  if (urls.empty() || cols <= 0) {
-    std::cerr << "Invalid grid parameters" << std::endl;
-    return false;
+  bool read(cv::Mat &frame) override {
+    if (!first_.empty()) {
+      frame = std::move(first_);
+      first_ = cv::Mat();
+      return true;
+    }
+    return readFrame(frame);
   }
 
-  const int rows = (static_cast<int>(urls.size()) + cols - 1) / cols;
-  const auto [term_width, term_height] = getTerminalSize();
-  const int cell_width = term_width / cols;
-  const int cell_height = term_height / rows;
+private:
+  bool readFrame(cv::Mat &frame) {
+    frame = pool_.acquire(size_, CV_8UC3);
+    if (readFully(process_.stdoutFd(), frame.data, frame.total() * 3))
+      return true;
+    pool_.release(std::move(frame));
+    frame = cv::Mat();
+    return false;
+  }
 
-  std::vector<std::vector<std::string>> all_lines;
-  all_lines.reserve(urls.size());
+  const cv::Size size_;
+  MatPool &pool_;
+  Subprocess process_;
+  cv::Mat first_;
+};
 
-  for (const auto &url : urls) {
-    const auto response = cpr::Get(cpr::Url{url});
-    if (response.status_code != 200) {
-      std::cerr << "Failed to download image: " << url << std::endl;
-      continue;
-    }
+// Plays the audio track in an ffplay child we own and follows its clock.
+// With -stats and a log level below info, ffplay rewrites a status line on
+// stderr about every 30 ms that starts with the master (audio) clock in
+// seconds; between reports the position is extrapolated on the wall clock.
+class AudioClock {
+public:
+  AudioClock() = default;
+  AudioClock(const AudioClock &) = delete;
+  AudioClock &operator=(const AudioClock &) = delete;
+  ~AudioClock() { stop(); }
 
-    const std::vector<uchar> imgData(response.text.begin(),
-                                     response.text.end());
-    const cv::Mat img = cv::imdecode(imgData, cv::IMREAD_COLOR);
-    if (img.empty()) {
-      std::cerr << "Failed to decode image: " << url << std::endl;
-      continue;
-    }
+  bool start(std::string_view path) {
+    if (!findExecutable("ffplay"))
+      return false;
+    const std::vector<std::string> args = {
+        "ffplay", "-hide_banner", "-nodisp", "-autoexit", "-vn", "-sn",
+        "-stats", "-loglevel", "error", std::string(path)};
+    if (!process_.start(args, false, false, true))
+      return false;
+    reader_ = std::thread([this] { readStatus(); });
+    return true;
+  }
 
-    RenderOptions cell_options = options;
-    cell_options.width = cell_width;
-    cell_options.height = cell_height;
-    all_lines.emplace_back(renderImageToLines(img, cell_options));
+  // True once the first position arrives; false if ffplay exits first (no
+  // audio track) or the timeout passes.
+  bool waitForStart(std::chrono::milliseconds timeout) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    started_.wait_for(lock, timeout, [this] { return reported_ || ended_; });
+    return reported_;
   }
 
-  const int max_height = std::max_element(all_lines.begin(), all_lines.end(),
-                                          [](const auto &a, const auto &b) {
-                                            return a.size() < b.size();
-                                          })
-                             ->size();
+  // Audio position in seconds, once ffplay has reported one.
+  std::optional<double> seconds() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!reported_)
+      return std::nullopt;
+    return position_ + std::chrono::duration<double>(
+                           std::chrono::steady_clock::now() - reported_at_)
+                           .count();
+  }
 
-  for (int i = 0; i < max_height; ++i) {
-    std::string row_line;
-    row_line.reserve(term_width);
+  void stop() {
+    process_.interrupt();
+    if (reader_.joinable())
+      reader_.join();
+    process_.terminate();
+  }
 
-    for (int c = 0; c < cols && c < static_cast<int>(all_lines.size()); ++c) {
-      if (i < static_cast<int>(all_lines[c].size())) {
-        row_line += all_lines[c][i];
-      } else {
-        row_line += std::string(cell_width, ' ');
+private:
+  void readStatus() {
+    std::string line;
+    char buffer[512];
+    for (;;) {
+      const ssize_t n = ::read(process_.stderrFd(), buffer, sizeof(buffer));
+      if (n < 0 && errno == EINTR)
+        continue;
+      if (n <= 0)
+        break;
+      for (ssize_t i = 0; i < n; ++i) {
+        if (buffer[i] == '\r' || buffer[i] == '\n') {
+          parseStatus(line);
+          line.clear();
+        } else {
+          line += buffer[i];
+        }
       }
     }
-    std::cout << row_line << '\n';
+    std::lock_guard<std::mutex> lock(mutex_);
+    ended_ = true;
+    started_.notify_all();
   }
-  std::cout.flush();
-  return true;
+
+  // "  12.34 M-A:  0.000 fd=   0 aq=   23KB ..."; "nan" before playback.
+  void parseStatus(const std::string &line) {
+    const char *begin = line.c_str();
+    char *end = nullptr;
+    const double position = std::strtod(begin, &end);
+    if (end == begin || !std::isfinite(position) ||
+        line.find(':', static_cast<std::size_t>(end - begin)) ==
+            std::string::npos) {
+      return;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    position_ = position;
+    reported_at_ = std::chrono::steady_clock::now();
+    reported_ = true;
+    started_.notify_all();
+  }
+
+  Subprocess process_;
+  std::thread reader_;
+  mutable std::mutex mutex_;
+  std::condition_variable started_;
+  double position_ = 0.0;
+  std::chrono::steady_clock::time_point reported_at_;
+  bool reported_ = false;
+  bool ended_ = false;
+};
+#else
+// No owned child processes on Windows yet: playback runs on the wall clock.
+class AudioClock {
+public:
+  bool start(std::string_view) { return false; }
+  bool waitForStart(std::chrono::milliseconds) { return false; }
+  std::optional<double> seconds() const { return std::nullopt; }
+  void stop() {}
+};
+#endif
+
+int playbackWorkerCount(const Sakura::RenderOptions &options) {
+  if (options.workerThreads > 0)
+    return options.workerThreads;
+  // Leave one core each for the decoder and the writer.
+  const int cores = static_cast<int>(std::thread::hardware_concurrency());
+  return std::max(1, cores - 2);
 }
+} // namespace
 
-bool Sakura::renderGifFromUrl(std::string_view gifUrl,
-                              const RenderOptions &options) const {
-  cv::VideoCapture cap{std::string(gifUrl)};
+bool Sakura::renderVideoFromFile(std::string_view videoPath,
+                                 const RenderOptions &options) const {
+  statusStream(options) << "Opening video: " << videoPath << std::endl;
+  cv::VideoCapture cap;
+  cap.open(std::string(videoPath));
   if (!cap.isOpened()) {
-    std::cerr << "Failed to open GIF" << std::endl;
+    std::cerr << "Failed to open video: " << videoPath << std::endl;
     return false;
   }
+  return playVideo(cap, videoPath, options);
+}
 
-  const int gif_width = static_cast<int>(cap.get(cv::CAP_PROP_FRAME_WIDTH));
-  const int gif_height = static_cast<int>(cap.get(cv::CAP_PROP_FRAME_HEIGHT));
-  double fps = cap.get(cv::CAP_PROP_FPS);
-  if (fps <= 0)
-    fps = 10.0; // Default GIF speed
-
-  const double gifAspect = static_cast<double>(gif_width) / gif_height;
-  const double termAspect = static_cast<double>(options.width) / options.height;
+// Plays an opened capture. videoPath is what the capture was opened from;
+// the ffmpeg pipe and the audio player open it again themselves.
+bool Sakura::playVideo(cv::VideoCapture &cap, std::string_view videoPath,
+                       const RenderOptions &options) const {
+  std::ostream &status = statusStream(options);
+  // Get video properties
+  double source_fps = cap.get(cv::CAP_PROP_FPS);
+  const int frame_count = static_cast<int>(cap.get(cv::CAP_PROP_FRAME_COUNT));
+  if (source_fps <= 0)
+    source_fps = 30.0;
+  const FrameDecimator decimator(source_fps, options.targetFps);
+  const double fps = decimator.outputFps();
 
-  RenderOptions gifOptions = options;
+  const bool sixel = options.mode == SIXEL;
+  // Delta frames and dirty tiles depend on what is on screen, so they are
+  // encoded in the writer, in display order, after the drop decision.
+  const bool delta = !sixel && options.deltaFrames;
+  const bool tiled = sixel && options.tileUpdates;
+  const bool encode_in_writer = delta || tiled;
+  const char *mode_name = sixel ? "SIXEL MODE" : "ULTRA-FAST MODE";
+  const int workers = playbackWorkerCount(options);
 
-  if (gifAspect > termAspect) {
-    gifOptions.width = options.width;
-    gifOptions.height = static_cast<int>(options.width / gifAspect);
-  } else {
-    gifOptions.height = options.height;
-    gifOptions.width = static_cast<int>(options.height * gifAspect);
+  status << "Video: " << source_fps << " FPS, " << frame_count
+         << " frames (" << mode_name << ", " << workers << " workers)"
+         << std::endl;
+  if (fps < source_fps) {
+    status << "Downsampling to " << fps << " FPS" << std::endl;
   }
+  status << "Target dimensions: " << options.width << "x" << options.height
+         << std::endl;
 
-  if (fps > 20.0) {
-    gifOptions.width = static_cast<int>(gifOptions.width * 0.95);
-    gifOptions.height = static_cast<int>(gifOptions.height * 0.95);
+  int target_width = options.width;
+  int target_height = options.height;
+  if (target_width <= 0 || target_height <= 0) {
+    const auto [w, h] = getTerminalSize();
+    if (target_width <= 0)
+      target_width = w;
+    if (target_height <= 0)
+      target_height = h;
   }
+  const cv::Size source_size(
+      static_cast<int>(cap.get(cv::CAP_PROP_FRAME_WIDTH)),
+      static_cast<int>(cap.get(cv::CAP_PROP_FRAME_HEIGHT)));
+  const FitGeometry fit =
+      fitGeometry(source_size, target_width, target_height, options);
+  target_width = fit.width;
+  target_height = fit.height;
+  const bool cropping = fit.source.size() != source_size;
+  const int interpolation =
+      options.fastResize ? cv::INTER_NEAREST : cv::INTER_AREA;
+  const cv::Mat lut = colourAdjustLut(options.contrast, options.brightness);
 
-  const auto frame_duration_ns =
-      std::chrono::nanoseconds(static_cast<long long>(1000000000.0 / fps));
-  const auto start_time = std::chrono::steady_clock::now();
+  const std::size_t queue_size =
+      static_cast<std::size_t>(std::max(options.queueSize, 1));
+  const std::size_t prebuffer = static_cast<std::size_t>(
+      std::clamp(options.prebufferFrames, 1, static_cast<int>(queue_size)));
 
-  int frame_number = 0;
-  int frames_dropped = 0;
+  QualityController quality(options, fps, workers, sixel);
 
-  std::cout.setf(std::ios::unitbuf); // Unbuffered output
-  std::cout << "\033[2J\033[?25l" << std::flush;
-  std::cout.setf(std::ios::unitbuf);
+  MatPool frames;
+  std::unique_ptr<FrameSource> source;
+  // The ffmpeg pipe already decimates to the output rate.
+  const FrameDecimator pass_through(fps, 0.0);
+  const FrameDecimator *source_decimator = &decimator;
+  // Frames from the ffmpeg pipe arrive already cropped to the fit.
+  bool source_cropped = false;
+#ifndef _WIN32
+  if (options.hwAccelPipe) {
+    auto pipe = std::make_unique<FfmpegFrameSource>(
+        scaledTargetSize(target_width, target_height, 1.0, sixel), frames);
+    if (pipe->open(videoPath, fps, fps < source_fps, options.fastResize,
+                   cropping ? fit.source : cv::Rect())) {
+      status << "Decoding through ffmpeg pipe (-hwaccel auto)" << std::endl;
+      cap.release();
+      source = std::move(pipe);
+      source_decimator = &pass_through;
+      source_cropped = true;
+    } else {
+      std::cerr << "ffmpeg pipe unavailable, falling back to OpenCV decode"
+                << std::endl;
+    }
+  }
+#endif
+  if (!source) {
+    source = std::make_unique<CaptureFrameSource>(cap, frames);
+  }
 
-  cv::Mat frame, resized_frame;
-  const cv::Size target_size(gifOptions.width, gifOptions.height);
+  BoundedQueue<VideoFrame> decoded(queue_size);
+  BoundedQueue<VideoFrame> encoded(queue_size);
+  std::unique_ptr<SixelPalette> palette;
+  if (sixel && options.staticPalette) {
+    palette = std::make_unique<SixelPalette>(options.sceneCutThreshold);
+  }
 
-  while (cap.read(frame)) {
-    // time syncing
-    const auto frame_start = std::chrono::steady_clock::now();
-    const auto elapsed_ns =
-        std::chrono::duration_cast<std::chrono::nanoseconds>(frame_start -
-                                                             start_time);
+  // Stage timings for stats(); without collectStats nothing is recorded.
+  Telemetry *telemetry = options.collectStats ? telemetry_.get() : nullptr;
+  const auto record = [telemetry](Stage stage,
+                                  std::chrono::steady_clock::time_point since) {
+    if (telemetry)
+      telemetry->record(stage, std::chrono::steady_clock::now() - since);
+  };
+  if (telemetry) {
+    telemetry->reset();
+    telemetry->startReporter(options.statsFile, options.statsInterval);
+  }
 
-    const long long target_frame =
-        elapsed_ns.count() / frame_duration_ns.count();
+  // Payload buffers cycle from the encoders through the terminal writer and
+  // back, so warm playback keeps reusing the same allocations.
+  const std::shared_ptr<OutputSink> sink = outputSink(options);
+  TerminalWriter terminal(*sink, options.outputBuffers,
+                          [telemetry](std::chrono::nanoseconds elapsed) {
+                            if (telemetry)
+                              telemetry->record(WRITE, elapsed);
+                          });
 
-    if (frame_number < target_frame) {
-      const int frames_behind = static_cast<int>(target_frame - frame_number);
-      if (frames_behind > 2 && frames_dropped < frame_number * 0.3) {
-        frame_number++;
-        frames_dropped++;
+  // Decoder: the only thread touching the source. Frames the decimator
+  // skips are only grabbed, never retrieved or converted.
+  std::thread decoder([&] {
+    for (long long source_index = 0;; ++source_index) {
+      if (!source_decimator->keep(source_index)) {
+        if (!source->grab())
+          break;
         continue;
       }
+      // Pooled buffers are exclusively owned while a frame is in flight.
+      cv::Mat frame;
+      const auto decode_start = std::chrono::steady_clock::now();
+      if (!source->read(frame))
+        break;
+      record(DECODE, decode_start);
+      VideoFrame job;
+      job.index = source_decimator->outputIndex(source_index);
+      job.image = std::move(frame);
+      if (!decoded.push(std::move(job)))
+        break;
+    }
+    decoded.close();
+  });
+
+  // Scale/encode workers: frames complete out of order, the writer restores
+  // presentation order from VideoFrame::index.
+  std::atomic<int> active_workers{workers};
+  std::vector<std::thread> pool;
+  pool.reserve(workers);
+  for (int i = 0; i < workers; ++i) {
+    pool.emplace_back([&] {
+      VideoFrame job;
+      cv::Mat scaled, scratch;
+      while (decoded.pop(job)) {
+        const auto encode_start = std::chrono::steady_clock::now();
+        // SIXEL sizes are in pixels; the cell renderers pack 2 rows per
+        // character.
+        job.size = scaledTargetSize(target_width, target_height,
+                                    quality.scaleFactor(), sixel);
+        // Sources that scale while decoding hand over target-size frames.
+        cv::Mat decoded_frame = std::move(job.image);
+        job.image = cv::Mat();
+        cv::Mat *output = &decoded_frame;
+        const cv::Mat visible =
+            cropping && !source_cropped
+                ? decoded_frame(fit.source &
+                                cv::Rect(cv::Point(), decoded_frame.size()))
+                : decoded_frame;
+        if (visible.size() != job.size || !lut.empty()) {
+          scaleAndAdjust(visible, job.size, interpolation, lut, scaled,
+                         scratch, telemetry);
+          output = &scaled;
+        } else if (cropping && !source_cropped) {
+          // Already target size, but still a view into the pooled frame.
+          visible.copyTo(scaled);
+          output = &scaled;
+        }
+        const auto render_start = std::chrono::steady_clock::now();
+        if (encode_in_writer) {
+          job.image = std::move(*output);
+          *output = cv::Mat();
+        } else if (sixel) {
+          job.payload = terminal.acquire();
+          job.payload += "\033[H";
+          if (!renderSixel(*output, job.payload, quality.paletteSize(),
+                           job.size.width, job.size.height,
+                           options.sixelQuality, palette.get(),
+                           options.sixelEncoder, options.quantizer)) {
+            job.payload.clear();
+          }
+          record(ENCODE, render_start);
+        } else {
+          job.payload = terminal.acquire();
+          job.payload += "\033[H";
+          renderVideoUltraFast(*output, job.payload);
+          record(ENCODE, render_start);
+        }
+        frames.release(std::move(decoded_frame));
+        job.encode_time = std::chrono::steady_clock::now() - encode_start;
+        if (!encoded.push(std::move(job)))
+          break;
+      }
+      if (--active_workers == 0)
+        encoded.close();
+    });
+  }
+
+  int frames_displayed = 0, frames_dropped = 0;
+  AudioClock audio;
+  bool audio_clocked = false;
+  double av_offset_sum = 0.0, av_offset_max = 0.0;
+
+  std::thread writer([&] {
+    std::map<long long, VideoFrame> pending;
+    VideoFrame frame;
+
+    // Prefill so the first frames do not race the audio.
+    while (pending.size() < prebuffer && encoded.pop(frame)) {
+      const long long index = frame.index;
+      pending.emplace(index, std::move(frame));
     }
 
-    cv::resize(frame, resized_frame, target_size, 0, 0, cv::INTER_NEAREST);
+    sink->write("\033[2J\033[?25l", CONTROL_WRITE); // Clear, hide cursor
+
+    // The audio position is the master clock if ffplay reports one within
+    // the wait; otherwise the wall clock since the first frame is. The
+    // choice holds for the whole playback, since switching clocks later
+    // would jump the timeline.
+    audio_clocked = options.playAudio && audio.start(videoPath) &&
+                    audio.waitForStart(std::chrono::seconds(1));
+    const auto start_time = std::chrono::steady_clock::now();
+    const auto clock = [&] {
+      if (audio_clocked)
+        return *audio.seconds();
+      return std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                           start_time)
+          .count();
+    };
+    const double frame_seconds = 1.0 / fps;
 
-    const std::string sixel_data =
-        renderSixel(resized_frame, gifOptions.paletteSize, gifOptions.width,
-                    gifOptions.height, gifOptions.sixelQuality);
-    std::cout << "\033[H" << sixel_data;
+    UltraFastDeltaEncoder delta_encoder(options.deltaThreshold);
+    std::unique_ptr<SixelTileEncoder> tile_encoder;
+    if (tiled) {
+      tile_encoder = std::make_unique<SixelTileEncoder>(
+          options, getTerminalCellSize());
+    }
+    // Without a static palette every frame gets its own, shared by its
+    // tiles.
+    SixelPalette frame_palette(-1.0);
+    const auto choose_palette = [&](const cv::Mat &image) {
+      return (palette ? palette.get() : &frame_palette)
+          ->update(toBgr(image), quality.paletteSize(), options.sixelQuality,
+                   options.sixelEncoder, options.quantizer);
+    };
+    cv::Size last_size;
+    long long next_index = 0;
+    while (true) {
+      if (!terminal.ok()) {
+        // The sink stopped playback; unblock the decoder and workers.
+        decoded.close();
+        encoded.close();
+        break;
+      }
+      auto it = pending.find(next_index);
+      if (it == pending.end()) {
+        if (!encoded.pop(frame))
+          break;
+        const long long index = frame.index;
+        pending.emplace(index, std::move(frame));
+        continue;
+      }
+      frame = std::move(it->second);
+      pending.erase(it);
+      ++next_index;
 
-    frame_number++;
+      if (!encode_in_writer && frame.payload.empty()) {
+        std::cerr << "Frame output is empty!" << std::endl;
+        continue;
+      }
 
-    const auto next_frame_time =
-        start_time + (frame_duration_ns * frame_number);
-    const auto now = std::chrono::steady_clock::now();
+      // Against the master clock: drop a frame that is already a full frame
+      // late so one stall does not push every following frame behind, and
+      // hold one that is early.
+      const double pts = frame.index * frame_seconds;
+      const auto now = std::chrono::steady_clock::now();
+      if (clock() - pts > frame_seconds) {
+        frames_dropped++;
+        if (telemetry)
+          ++telemetry->dropped;
+        quality.record(frame.index, frame.encode_time, {}, true);
+        terminal.recycle(std::move(frame.payload));
+        continue;
+      }
+      if (encode_in_writer) {
+        frame.payload = terminal.acquire();
+        if (tiled) {
+          tile_encoder->encode(frame.image, frame.payload, choose_palette);
+        } else {
+          delta_encoder.encode(frame.image, frame.payload);
+        }
+        frames.release(std::move(frame.image));
+        frame.image = cv::Mat();
+        record(ENCODE, now);
+      }
+      const auto serial_encode = std::chrono::steady_clock::now() - now;
+      const double early = pts - clock();
+      if (early > 0.0) {
+        const auto slack_start = std::chrono::steady_clock::now();
+        std::this_thread::sleep_for(std::chrono::duration<double>(early));
+        record(SLACK, slack_start);
+      }
 
-    if (next_frame_time > now) {
-      std::this_thread::sleep_until(next_frame_time);
+      // Display frame
+      if (last_size.area() > 0 && frame.size != last_size) {
+        frame.payload.insert(0, "\033[2J"); // Clear what a larger frame left
+      }
+      last_size = frame.size;
+      FrameInfo info;
+      info.index = frame.index;
+      info.pts = pts;
+      info.delta = encode_in_writer;
+      terminal.submit(std::move(frame.payload), info);
+      frame.payload = std::string();
+      frames_displayed++;
+      if (telemetry)
+        ++telemetry->displayed;
+      // Positive when the picture trails the sound.
+      const double av_offset = clock() - pts;
+      av_offset_sum += std::abs(av_offset);
+      av_offset_max = std::max(av_offset_max, std::abs(av_offset));
+      // Writes finish on the terminal thread; their time since the last
+      // frame is the writer's share of the budget.
+      quality.record(frame.index, frame.encode_time,
+                     serial_encode + terminal.takeWriteTime(),
+                     av_offset > frame_seconds);
     }
+  });
+
+  decoder.join();
+  for (auto &worker : pool) {
+    worker.join();
   }
+  writer.join();
+  terminal.close();
+  if (telemetry)
+    telemetry->stopReporter();
 
-  std::cout << "\033[?25h" << std::flush;
-  std::cout.unsetf(std::ios::unitbuf);
+  audio.stop();
+  sink->write("\033[?25h", CONTROL_WRITE); // Show cursor
+
+  const int frames_total = frames_displayed + frames_dropped;
+  double drop_rate =
+      frames_total > 0 ? 100.0 * frames_dropped / frames_total : 0.0;
+  status << "\nPerformance: Displayed=" << frames_displayed
+         << " Dropped=" << frames_dropped << " (" << std::fixed
+         << std::setprecision(1) << drop_rate << "%) " << mode_name
+         << std::endl;
+  if (frames_displayed > 0) {
+    status << "A/V offset: mean "
+           << 1000.0 * av_offset_sum / frames_displayed << " ms, max "
+           << 1000.0 * av_offset_max << " ms ("
+           << (audio_clocked ? "audio clock" : "wall clock, no audio")
+           << ")" << std::endl;
+  }
+  if (quality.enabled()) {
+    status << "Quality: " << quality.adjustments()
+           << " adjustments, palette=" << quality.paletteSize()
+           << " scale=" << std::setprecision(2) << quality.scaleFactor()
+           << std::endl;
+  }
 
-  cap.release();
   return true;
 }
 
-bool Sakura::renderVideoFromUrl(std::string_view videoUrl,
-                                const RenderOptions &options) const {
-  const auto response = cpr::Get(cpr::Url{std::string(videoUrl)});
-  if (response.status_code != 200) {
-    std::cerr << "Failed to download video. Status: " << response.status_code
-              << std::endl;
+namespace {
+// .sakura container, integers little-endian:
+//   header    64 bytes, written last so a partial file never validates
+//   source    path of the transcoded video, for its audio track
+//   payloads  encoded frames back to back, each exactly what playback writes
+//   index     32 bytes per frame: u64 offset, u64 size, f64 pts in seconds,
+//             u32 flags, 4 bytes reserved
+constexpr char CONTAINER_MAGIC[8] = {'S', 'A', 'K', 'U', 'R', 'A', '\0', '\1'};
+constexpr std::uint32_t CONTAINER_VERSION = 1;
+constexpr std::size_t CONTAINER_HEADER_SIZE = 64;
+constexpr std::size_t CONTAINER_ENTRY_SIZE = 32;
+// Frames patch the previous one (delta or tile updates), so only keyframes
+// may be skipped to during playback.
+constexpr std::uint32_t CONTAINER_DELTA = 1;
+// Entry flag: the frame redraws the whole picture.
+constexpr std::uint32_t ENTRY_KEYFRAME = 1;
+
+struct ContainerHeader {
+  std::uint32_t mode = 0;
+  std::uint32_t width = 0; // cells for ULTRA_FAST, pixels for SIXEL
+  std::uint32_t height = 0;
+  std::uint32_t flags = 0;
+  double fps = 0.0;
+  std::uint64_t frames = 0;
+  std::uint64_t index_offset = 0;
+  // Terminal cell size in pixels when transcoded; SIXEL tile updates are
+  // positioned in cells of this size.
+  std::uint32_t cell_width = 0;
+  std::uint32_t cell_height = 0;
+  std::string source;
+};
+
+struct ContainerEntry {
+  std::uint64_t offset = 0;
+  std::uint64_t size = 0;
+  double pts = 0.0;
+  std::uint32_t flags = 0;
+};
+
+void putLittleEndian(std::string &out, std::uint64_t value, int bytes) {
+  for (int i = 0; i < bytes; ++i)
+    out += static_cast<char>((value >> (8 * i)) & 0xff);
+}
+
+std::uint64_t getLittleEndian(const char *in, int bytes) {
+  std::uint64_t value = 0;
+  for (int i = 0; i < bytes; ++i)
+    value |= static_cast<std::uint64_t>(static_cast<unsigned char>(in[i]))
+             << (8 * i);
+  return value;
+}
+
+std::uint64_t doubleBits(double value) {
+  std::uint64_t bits;
+  std::memcpy(&bits, &value, sizeof(bits));
+  return bits;
+}
+
+double bitsDouble(std::uint64_t bits) {
+  double value;
+  std::memcpy(&value, &bits, sizeof(value));
+  return value;
+}
+
+std::string serializeHeader(const ContainerHeader &header) {
+  std::string out(CONTAINER_MAGIC, sizeof(CONTAINER_MAGIC));
+  putLittleEndian(out, CONTAINER_VERSION, 4);
+  putLittleEndian(out, header.mode, 4);
+  putLittleEndian(out, header.width, 4);
+  putLittleEndian(out, header.height, 4);
+  putLittleEndian(out, header.flags, 4);
+  putLittleEndian(out, header.source.size(), 4);
+  putLittleEndian(out, doubleBits(header.fps), 8);
+  putLittleEndian(out, header.frames, 8);
+  putLittleEndian(out, header.index_offset, 8);
+  putLittleEndian(out, header.cell_width, 4);
+  putLittleEndian(out, header.cell_height, 4);
+  out.resize(CONTAINER_HEADER_SIZE, '\0');
+  return out;
+}
+
+void putEntry(std::string &index, const ContainerEntry &entry) {
+  putLittleEndian(index, entry.offset, 8);
+  putLittleEndian(index, entry.size, 8);
+  putLittleEndian(index, doubleBits(entry.pts), 8);
+  putLittleEndian(index, entry.flags, 4);
+  putLittleEndian(index, 0, 4);
+}
+
+// Validates the header and that the index lies inside the file.
+bool parseContainer(std::string_view bytes, ContainerHeader &header) {
+  if (bytes.size() < CONTAINER_HEADER_SIZE ||
+      bytes.compare(0, sizeof(CONTAINER_MAGIC),
+                    std::string_view(CONTAINER_MAGIC,
+                                     sizeof(CONTAINER_MAGIC))) != 0 ||
+      getLittleEndian(bytes.data() + 8, 4) != CONTAINER_VERSION) {
     return false;
   }
+  const char *p = bytes.data();
+  header.mode = static_cast<std::uint32_t>(getLittleEndian(p + 12, 4));
+  header.width = static_cast<std::uint32_t>(getLittleEndian(p + 16, 4));
+  header.height = static_cast<std::uint32_t>(getLittleEndian(p + 20, 4));
+  header.flags = static_cast<std::uint32_t>(getLittleEndian(p + 24, 4));
+  const std::uint64_t source_size = getLittleEndian(p + 28, 4);
+  header.fps = bitsDouble(getLittleEndian(p + 32, 8));
+  header.frames = getLittleEndian(p + 40, 8);
+  header.index_offset = getLittleEndian(p + 48, 8);
+  header.cell_width = static_cast<std::uint32_t>(getLittleEndian(p + 56, 4));
+  header.cell_height = static_cast<std::uint32_t>(getLittleEndian(p + 60, 4));
 
-  const std::string tempFile =
-      "/tmp/sakura_video_" + std::to_string(std::time(nullptr));
-  std::ofstream file(tempFile, std::ios::binary);
-  file.write(response.text.data(), response.text.size());
-  file.close();
-
-  const bool result = renderVideoFromFile(tempFile, options);
+  const std::uint64_t payloads = CONTAINER_HEADER_SIZE + source_size;
+  if (!(header.fps > 0.0) || header.index_offset < payloads ||
+      header.index_offset > bytes.size() ||
+      header.frames > (bytes.size() - header.index_offset) /
+                          CONTAINER_ENTRY_SIZE) {
+    return false;
+  }
+  header.source.assign(p + CONTAINER_HEADER_SIZE, source_size);
+  return true;
+}
 
-  std::remove(tempFile.c_str());
-  return result;
+// Reads index entry i straight from the mapping and bounds-checks it.
+bool readEntry(std::string_view bytes, const ContainerHeader &header,
+               std::uint64_t i, ContainerEntry &entry) {
+  const char *p = bytes.data() + header.index_offset + i * CONTAINER_ENTRY_SIZE;
+  entry.offset = getLittleEndian(p, 8);
+  entry.size = getLittleEndian(p + 8, 8);
+  entry.pts = bitsDouble(getLittleEndian(p + 16, 8));
+  entry.flags = static_cast<std::uint32_t>(getLittleEndian(p + 24, 4));
+  const std::uint64_t payloads = CONTAINER_HEADER_SIZE + header.source.size();
+  return entry.offset >= payloads && entry.offset <= header.index_offset &&
+         entry.size <= header.index_offset - entry.offset;
 }
 
-bool Sakura::renderVideoFromFile(std::string_view videoPath,
-                                 const RenderOptions &options) const {
-  std::cout << "Opening video: " << videoPath << std::endl;
+// Read-only view of a whole file: a private memory map on POSIX, so frames
+// are written from the page cache without copying; read into memory on
+// Windows.
+class MappedFile {
+public:
+  MappedFile() = default;
+  MappedFile(const MappedFile &) = delete;
+  MappedFile &operator=(const MappedFile &) = delete;
+
+#ifdef _WIN32
+  bool open(const std::string &path) { return readFile(path, contents_); }
+  std::string_view bytes() const noexcept { return contents_; }
+
+private:
+  std::string contents_;
+#else
+  ~MappedFile() {
+    if (data_ != nullptr)
+      ::munmap(data_, size_);
+  }
+
+  bool open(const std::string &path) {
+    const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+      return false;
+    struct stat info;
+    if (::fstat(fd, &info) != 0 || info.st_size <= 0) {
+      ::close(fd);
+      return false;
+    }
+    size_ = static_cast<std::size_t>(info.st_size);
+    void *data = ::mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (data == MAP_FAILED)
+      return false;
+    ::madvise(data, size_, MADV_SEQUENTIAL);
+    data_ = data;
+    return true;
+  }
+
+  std::string_view bytes() const noexcept {
+    return {static_cast<const char *>(data_), size_};
+  }
+
+private:
+  void *data_ = nullptr;
+  std::size_t size_ = 0;
+#endif
+};
+} // namespace
+
+bool Sakura::transcodeVideo(std::string_view videoPath,
+                            std::string_view outputPath,
+                            const RenderOptions &options) const {
+  const bool sixel = options.mode == SIXEL;
+  if (!sixel && options.mode != ULTRA_FAST) {
+    std::cerr << "Transcoding supports ULTRA_FAST and SIXEL only" << std::endl;
+    return false;
+  }
   cv::VideoCapture cap;
   cap.open(std::string(videoPath));
   if (!cap.isOpened()) {
     std::cerr << "Failed to open video: " << videoPath << std::endl;
     return false;
   }
+  double source_fps = cap.get(cv::CAP_PROP_FPS);
+  if (source_fps <= 0)
+    source_fps = 30.0;
+  const FrameDecimator decimator(source_fps, options.targetFps);
 
-  // Get video properties
-  double fps = cap.get(cv::CAP_PROP_FPS);
-  const int frame_count = static_cast<int>(cap.get(cv::CAP_PROP_FRAME_COUNT));
-  if (fps <= 0)
-    fps = 30.0;
+  int target_width = options.width;
+  int target_height = options.height;
+  if (target_width <= 0 || target_height <= 0) {
+    const auto [w, h] = getTerminalSize();
+    if (target_width <= 0)
+      target_width = w;
+    if (target_height <= 0)
+      target_height = h;
+  }
+  const cv::Size source_size(
+      static_cast<int>(cap.get(cv::CAP_PROP_FRAME_WIDTH)),
+      static_cast<int>(cap.get(cv::CAP_PROP_FRAME_HEIGHT)));
+  const FitGeometry fit =
+      fitGeometry(source_size, target_width, target_height, options);
+  target_width = fit.width;
+  target_height = fit.height;
+  const cv::Size size =
+      scaledTargetSize(target_width, target_height, 1.0, sixel);
+  const int interpolation =
+      options.fastResize ? cv::INTER_NEAREST : cv::INTER_AREA;
+  const cv::Mat lut = colourAdjustLut(options.contrast, options.brightness);
+  const bool delta = sixel ? options.tileUpdates : options.deltaFrames;
 
-  std::cout << "Video: " << fps << " FPS, " << frame_count
-            << " frames (ULTRA-FAST MODE)" << std::endl;
-  std::cout << "Target dimensions: " << options.width << "x" << options.height
-            << std::endl;
+  ContainerHeader header;
+  header.mode = static_cast<std::uint32_t>(options.mode);
+  header.width = static_cast<std::uint32_t>(target_width);
+  header.height = static_cast<std::uint32_t>(target_height);
+  header.flags = delta ? CONTAINER_DELTA : 0;
+  header.fps = decimator.outputFps();
+  const auto [cell_width, cell_height] = getTerminalCellSize();
+  header.cell_width = static_cast<std::uint32_t>(cell_width);
+  header.cell_height = static_cast<std::uint32_t>(cell_height);
+  std::error_code error;
+  header.source = std::filesystem::absolute(std::string(videoPath), error)
+                      .string();
+  if (error)
+    header.source = std::string(videoPath);
 
-  // Use terminal dimensions for COVER mode
-  const int target_width = options.width;
-  const int target_height =
-      options.height * 2; // Double height since we use 2 rows per character
+  // Written beside the target and renamed into place when complete.
+  const std::string temp = std::string(outputPath) + ".partial";
+  std::ofstream file(temp, std::ios::binary | std::ios::trunc);
+  if (!file) {
+    std::cerr << "Failed to create " << temp << std::endl;
+    return false;
+  }
+  file << serializeHeader(ContainerHeader{}) << header.source;
 
-  std::cout << "\033[2J\033[?25l" << std::flush; // Clear screen, hide cursor
+  UltraFastDeltaEncoder delta_encoder(options.deltaThreshold);
+  std::unique_ptr<SixelTileEncoder> tiles;
+  if (sixel && delta) {
+    tiles = std::make_unique<SixelTileEncoder>(
+        options, std::make_pair(cell_width, cell_height));
+  }
+  std::unique_ptr<SixelPalette> palette;
+  if (sixel && options.staticPalette) {
+    palette = std::make_unique<SixelPalette>(options.sceneCutThreshold);
+  }
+  const auto encode_sixel = [&](const cv::Mat &image, std::string &out) {
+    renderSixel(image, out, options.paletteSize, image.cols, image.rows,
+                options.sixelQuality, palette.get(), options.sixelEncoder,
+                options.quantizer);
+  };
+  // Without a static palette every frame gets its own, shared by its tiles.
+  SixelPalette frame_palette(-1.0);
+  const auto choose_palette = [&](const cv::Mat &image) {
+    return (palette ? palette.get() : &frame_palette)
+        ->update(toBgr(image), options.paletteSize, options.sixelQuality,
+                 options.sixelEncoder, options.quantizer);
+  };
 
-  // Start audio
-  std::string audio_cmd =
-      "ffplay -nodisp -autoexit -vn -nostats -loglevel quiet -sync video \"" +
-      std::string(videoPath) + "\" 2>/dev/null &";
-  std::system(audio_cmd.c_str());
+  std::uint64_t offset = CONTAINER_HEADER_SIZE + header.source.size();
+  std::string index;
+  cv::Mat frame, scaled, scratch;
+  std::string payload;
+  for (long long source_index = 0; cap.grab(); ++source_index) {
+    if (!decimator.keep(source_index))
+      continue;
+    if (!cap.retrieve(frame))
+      break;
+    scaleAndAdjust(frame(fit.source & cv::Rect(cv::Point(), frame.size())),
+                   size, interpolation, lut, scaled, scratch, nullptr);
 
-  const auto frame_duration =
-      std::chrono::microseconds(static_cast<int64_t>(1000000.0 / fps));
-  const auto start_time = std::chrono::steady_clock::now();
+    payload.clear();
+    bool keyframe = true;
+    if (tiles) {
+      keyframe = tiles->encode(scaled, payload, choose_palette);
+    } else if (sixel) {
+      payload = "\033[H";
+      encode_sixel(scaled, payload);
+    } else if (delta) {
+      // Periodic full redraws give playback keyframes to resync from.
+      if (options.tileRefreshInterval > 0 && header.frames > 0 &&
+          header.frames % options.tileRefreshInterval == 0) {
+        delta_encoder.reset();
+      }
+      keyframe = delta_encoder.encode(scaled, payload);
+    } else {
+      payload = "\033[H";
+      renderVideoUltraFast(scaled, payload);
+    }
+    file.write(payload.data(), static_cast<std::streamsize>(payload.size()));
 
-  int frames_displayed = 0, frames_dropped = 0;
-  cv::Mat frame, resized_frame;
+    const double pts = decimator.outputIndex(source_index) / header.fps;
+    putEntry(index, {offset, payload.size(), pts,
+                     keyframe ? ENTRY_KEYFRAME : 0});
+    offset += payload.size();
+    ++header.frames;
+  }
+  cap.release();
 
-  while (cap.read(frame)) {
-    if (frame.empty())
-      break;
+  header.index_offset = offset;
+  file.write(index.data(), static_cast<std::streamsize>(index.size()));
+  file.seekp(0);
+  file << serializeHeader(header);
+  file.close();
+  if (!file || header.frames == 0) {
+    std::cerr << "Failed to transcode " << videoPath << std::endl;
+    std::filesystem::remove(temp, error);
+    return false;
+  }
+  std::filesystem::rename(temp, std::string(outputPath), error);
+  if (error) {
+    std::cerr << "Failed to write " << outputPath << ": " << error.message()
+              << std::endl;
+    std::filesystem::remove(temp, error);
+    return false;
+  }
 
-    const auto frame_start = std::chrono::steady_clock::now();
+  std::cout << "Transcoded " << header.frames << " frames ("
+            << (sixel ? "SIXEL" : "ULTRA_FAST") << ", " << target_width << "x"
+            << target_height << " @ " << header.fps << " FPS, "
+            << (offset + index.size()) / (1 << 20) << " MB) to " << outputPath
+            << std::endl;
+  return true;
+}
 
-    // Resize frame for COVER mode
-    cv::resize(frame, resized_frame, cv::Size(target_width, target_height), 0,
-               0, cv::INTER_NEAREST);
+bool Sakura::playTranscoded(std::string_view path, const RenderOptions &options,
+                            int loops) const {
+  std::ostream &status = statusStream(options);
+  MappedFile file;
+  if (!file.open(std::string(path))) {
+    std::cerr << "Failed to open " << path << std::endl;
+    return false;
+  }
+  const std::string_view bytes = file.bytes();
+  ContainerHeader header;
+  if (!parseContainer(bytes, header)) {
+    std::cerr << "Not a .sakura container: " << path << std::endl;
+    return false;
+  }
+  const bool sixel = header.mode == static_cast<std::uint32_t>(SIXEL);
+  if (!sixel && header.mode != static_cast<std::uint32_t>(ULTRA_FAST)) {
+    std::cerr << "Unsupported render mode in " << path << std::endl;
+    return false;
+  }
+  const bool delta = (header.flags & CONTAINER_DELTA) != 0;
+  // Checked against this terminal only when frames go to it.
+  if (!options.sink) {
+    const auto [cols, rows] = getTerminalSize();
+    const auto [cell_width, cell_height] = getTerminalCellSize();
+    // Tile updates are positioned in the transcoding terminal's cells, so on
+    // other cells they land in the wrong place.
+    if (sixel && delta &&
+        (header.cell_width != static_cast<std::uint32_t>(cell_width) ||
+         header.cell_height != static_cast<std::uint32_t>(cell_height))) {
+      std::cerr << path << " was transcoded with tile updates for "
+                << header.cell_width << "x" << header.cell_height
+                << " pixel cells, but this terminal's are " << cell_width
+                << "x" << cell_height << "; transcode it again here"
+                << std::endl;
+      return false;
+    }
+    // SIXEL geometry is in pixels, ULTRA_FAST geometry in cells. Frames
+    // larger than the terminal wrap and scroll, which is only a warning.
+    const auto cells = [sixel](std::uint32_t size, int cell) {
+      const auto pixels = static_cast<std::uint32_t>(cell);
+      return sixel ? (size + pixels - 1) / pixels : size;
+    };
+    const std::uint32_t width_cells = cells(header.width, cell_width);
+    const std::uint32_t height_cells = cells(header.height, cell_height);
+    if (width_cells > static_cast<std::uint32_t>(cols) ||
+        height_cells > static_cast<std::uint32_t>(rows)) {
+      std::cerr << "Warning: " << path << " needs " << width_cells << "x"
+                << height_cells << " cells, more than this terminal's "
+                << cols << "x" << rows << "; frames will wrap" << std::endl;
+    }
+  }
 
-    // Use ultra-fast renderer (no SIXEL)
-    const std::string frame_output = renderVideoUltraFast(resized_frame);
-    if (frame_output.empty()) {
-      std::cerr << "Frame output is empty!" << std::endl;
-      continue;
+  const double frame_seconds = 1.0 / header.fps;
+  // Delta frames cannot be dropped one by one; a late delta stream instead
+  // jumps ahead to the last keyframe already due.
+  std::vector<std::pair<double, std::uint64_t>> keyframes; // pts, index
+  if (delta) {
+    for (std::uint64_t i = 0; i < header.frames; ++i) {
+      ContainerEntry entry;
+      if (readEntry(bytes, header, i, entry) &&
+          (entry.flags & ENTRY_KEYFRAME) != 0) {
+        keyframes.emplace_back(entry.pts, i);
+      }
     }
+  }
+  std::error_code error;
+  const bool has_audio = options.playAudio && !header.source.empty() &&
+                         std::filesystem::exists(header.source, error);
 
-    // Display frame
-    std::cout << "\033[H" << frame_output << std::flush;
-    frames_displayed++;
+  Telemetry *telemetry = options.collectStats ? telemetry_.get() : nullptr;
+  if (telemetry) {
+    telemetry->reset();
+    telemetry->startReporter(options.statsFile, options.statsInterval);
+  }
 
-    // Frame timing
-    const auto target_time = start_time + (frames_displayed * frame_duration);
-    const auto now = std::chrono::steady_clock::now();
+  const std::shared_ptr<OutputSink> sink = outputSink(options);
+  long long frames_displayed = 0, frames_dropped = 0;
+  double max_lag = 0.0;
+  bool ok = sink->write("\033[2J\033[?25l", CONTROL_WRITE);
+  for (int loop = 0; ok && (loops <= 0 || loop < loops); ++loop) {
+    AudioClock audio;
+    // Chosen once per loop, as in playVideo.
+    const bool audio_clocked = has_audio && audio.start(header.source) &&
+                               audio.waitForStart(std::chrono::seconds(1));
+    const auto start_time = std::chrono::steady_clock::now();
+    const auto clock = [&] {
+      if (audio_clocked)
+        return *audio.seconds();
+      return std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                           start_time)
+          .count();
+    };
 
-    if (now < target_time) {
-      std::this_thread::sleep_until(target_time);
-    } else {
-      frames_dropped++;
+    for (std::uint64_t i = 0; i < header.frames; ++i) {
+      ContainerEntry entry;
+      if (!readEntry(bytes, header, i, entry)) {
+        std::cerr << "Corrupt frame index in " << path << std::endl;
+        ok = false;
+        break;
+      }
+      const double now = clock();
+      double late = now - entry.pts;
+      if (late > frame_seconds) {
+        if (!delta) {
+          frames_dropped++;
+          if (telemetry)
+            ++telemetry->dropped;
+          continue;
+        }
+        const auto due = std::upper_bound(
+            keyframes.begin(), keyframes.end(),
+            std::make_pair(now, std::numeric_limits<std::uint64_t>::max()));
+        if (due != keyframes.begin() && std::prev(due)->second > i) {
+          const std::uint64_t target = std::prev(due)->second;
+          frames_dropped += static_cast<long long>(target - i);
+          if (telemetry)
+            telemetry->dropped += static_cast<long long>(target - i);
+          i = target;
+          if (!readEntry(bytes, header, i, entry)) {
+            std::cerr << "Corrupt frame index in " << path << std::endl;
+            ok = false;
+            break;
+          }
+          late = now - entry.pts;
+        }
+        max_lag = std::max(max_lag, late);
+      }
+      if (late < 0.0) {
+        const auto slack_start = std::chrono::steady_clock::now();
+        std::this_thread::sleep_for(std::chrono::duration<double>(-late));
+        if (telemetry)
+          telemetry->record(SLACK,
+                            std::chrono::steady_clock::now() - slack_start);
+      }
+
+      // Straight from the mapping: the only copy is the sink's.
+      const auto write_start = std::chrono::steady_clock::now();
+      FrameInfo info;
+      info.index = static_cast<long long>(loop * header.frames + i);
+      info.pts = loop * (header.frames / header.fps) + entry.pts;
+      info.delta = delta;
+      ok = sink->write(bytes.substr(entry.offset, entry.size), info);
+      if (!ok)
+        break;
+      frames_displayed++;
+      if (telemetry) {
+        telemetry->record(WRITE, std::chrono::steady_clock::now() - write_start);
+        ++telemetry->displayed;
+      }
     }
+    audio.stop();
   }
+  if (telemetry)
+    telemetry->stopReporter();
+  sink->write("\033[?25h", CONTROL_WRITE);
 
-  std::cout << "\033[?25h"; // Show cursor
-  std::system("pkill -f 'ffplay.*-nodisp' 2>/dev/null");
-
-  double drop_rate =
-      frames_displayed > 0 ? 100.0 * frames_dropped / frames_displayed : 0.0;
-  std::cout << "\nPerformance: Displayed=" << frames_displayed
-            << " Dropped=" << frames_dropped << " (" << std::fixed
-            << std::setprecision(1) << drop_rate << "%) ULTRA-FAST MODE"
-            << std::endl;
-
-  return true;
+  const long long frames_total = frames_displayed + frames_dropped;
+  status << "\nPerformance: Displayed=" << frames_displayed
+         << " Dropped=" << frames_dropped << " (" << std::fixed
+         << std::setprecision(1)
+         << (frames_total > 0 ? 100.0 * frames_dropped / frames_total : 0.0)
+         << "%) PRE-RENDERED" << std::endl;
+  if (max_lag > frame_seconds) {
+    status << "Delta frames ran up to " << std::setprecision(2) << max_lag
+           << "s behind the clock" << std::endl;
+  }
+  return ok;
 }
@@ -1,19 +1,177 @@
 #ifndef SAKURA_HPP
 #define SAKURA_HPP
 
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <mutex>
 #include <opencv2/opencv.hpp>
 #include <string>
 #include <string_view>
+#include <utility>
 #include <vector>
 
 class Sakura {
 public:
   enum CharStyle { SIMPLE, DETAILED, BLOCKS };
   enum RenderMode { EXACT, ASCII_COLOR, ASCII_GRAY, SIXEL, ULTRA_FAST };
-  enum DitherMode { NONE, FLOYD_STEINBERG };
+  enum DitherMode {
+    NONE,
+    FLOYD_STEINBERG,
+    FLOYD_STEINBERG_SERPENTINE, // alternate scan direction per row
+    BAYER                       // ordered, row-parallel, stable across frames
+  };
   enum FitMode { STRETCH, COVER, CONTAIN };
 
   enum SixelQuality { LOW, HIGH };
+  enum Quantizer { KMEANS, MEDIAN_CUT, OCTREE };
+  enum SixelEncoder { LIBSIXEL, NATIVE };
+
+  // Reported by playback each time adaptivePalette/adaptiveScale step the
+  // output quality. Loads are window means relative to the frame budget.
+  struct QualityEvent {
+    long long frame = 0;
+    int paletteSize = 0;
+    double scaleFactor = 1.0;
+    double encodeLoad = 0.0; // encode time / (frame budget * workers)
+    double writeLoad = 0.0;  // writer-thread time / frame budget
+    double lateRatio = 0.0;  // share of late or dropped frames
+  };
+
+  // Playback stages timed when RenderOptions::collectStats is set.
+  enum Stage { DECODE, ADJUST, RESIZE, ENCODE, WRITE, SLACK };
+  static constexpr int STAGE_COUNT = 6;
+
+  // Latency distribution of one stage, in milliseconds.
+  struct StageStats {
+    long long count = 0;
+    double mean = 0.0;
+    double p50 = 0.0;
+    double p95 = 0.0;
+    double p99 = 0.0;
+    double max = 0.0;
+  };
+
+  struct PlaybackStats {
+    StageStats stages[STAGE_COUNT];
+    long long framesDisplayed = 0;
+    long long framesDropped = 0;
+  };
+
+  // Opt-in cache for URL images, shared between renders through
+  // RenderOptions::cache. Decoded images are kept in memory under an LRU
+  // byte budget; rendered output is kept under a hash of the image content
+  // and the options that affect it, on disk or, without a directory, in the
+  // same LRU. Servers are asked with ETag/Last-Modified whether an image
+  // changed, at most once per revalidateSeconds; 0 asks on every render.
+  // Safe to share between threads.
+  class RenderCache {
+  public:
+    explicit RenderCache(std::size_t memoryBudget = 64 << 20,
+                         std::string directory = "", // empty: memory only
+                         int revalidateSeconds = 60);
+    ~RenderCache();
+    RenderCache(const RenderCache &) = delete;
+    RenderCache &operator=(const RenderCache &) = delete;
+
+  private:
+    friend class Sakura;
+    struct State;
+
+    using Renderer = std::function<bool(const cv::Mat &, std::string &)>;
+
+    // Rendered output for url under key; render() runs on a miss.
+    bool fetch(std::string_view url, const std::string &key,
+               const Renderer &render, std::string &output);
+
+    std::unique_ptr<State> state_;
+  };
+
+  // Describes one write to an OutputSink.
+  struct FrameInfo {
+    long long index = 0; // display order within a playback; 0 for stills
+    double pts = 0.0;    // presentation time in seconds from playback start
+    bool delta = false;  // only patches the previous frame (delta/tile updates)
+    bool control = false; // terminal setup (clear, cursor), not a frame
+  };
+
+  // Destination for rendered output, set through RenderOptions::sink. Every
+  // render path hands over each finished frame in one write() call, from one
+  // thread at a time; the bytes are only valid during the call.
+  class OutputSink {
+  public:
+    virtual ~OutputSink() = default;
+    // False stops playback.
+    virtual bool write(std::string_view bytes, const FrameInfo &info) = 0;
+  };
+
+  // Writes to a file descriptor (stdout by default), each frame in one
+  // writev and optionally inside DEC 2026 synchronized-update markers.
+  class FdSink : public OutputSink {
+  public:
+    explicit FdSink(int fd = 1, bool synchronizedUpdates = true);
+    bool write(std::string_view bytes, const FrameInfo &info) override;
+
+  private:
+    const int fd_;
+    const bool synchronized_;
+  };
+
+  // Appends everything, control sequences included, to a growable buffer.
+  class BufferSink : public OutputSink {
+  public:
+    bool write(std::string_view bytes, const FrameInfo &info) override;
+    const std::string &buffer() const noexcept { return buffer_; }
+    std::string take() noexcept { return std::exchange(buffer_, {}); }
+    long long frames() const noexcept { return frames_; }
+
+  private:
+    std::string buffer_;
+    long long frames_ = 0;
+  };
+
+  // Keeps the newest `capacity` frames for a consumer on another thread,
+  // overwriting the oldest when full. Slot buffers are reused, so a warm
+  // ring does not allocate. Control writes are not kept.
+  class RingSink : public OutputSink {
+  public:
+    explicit RingSink(std::size_t capacity = 3);
+    bool write(std::string_view bytes, const FrameInfo &info) override;
+    // Swaps the oldest frame into `frame`; false when empty. Give the
+    // previous frame's buffer back through `frame` to recycle it.
+    bool pop(std::string &frame, FrameInfo &info);
+    long long overwritten() const;
+
+  private:
+    struct Slot {
+      std::string bytes;
+      FrameInfo info;
+    };
+    mutable std::mutex mutex_;
+    std::vector<Slot> slots_;
+    std::size_t head_ = 0;
+    std::size_t size_ = 0;
+    long long overwritten_ = 0;
+  };
+
+  // Forwards every write to a function.
+  class CallbackSink : public OutputSink {
+  public:
+    using Callback = std::function<bool(std::string_view, const FrameInfo &)>;
+    explicit CallbackSink(Callback callback);
+    bool write(std::string_view bytes, const FrameInfo &info) override;
+
+  private:
+    Callback callback_;
+  };
+
+  // Outcome of renderBatch.
+  struct BatchReport {
+    std::size_t rendered = 0;
+    std::vector<std::pair<std::string, std::string>> failures; // input, reason
+    double seconds = 0.0;
+    double imagesPerSecond = 0.0;
+  };
 
   struct RenderOptions {
     int width = 0;
@@ -26,12 +184,17 @@ public:
     double contrast = 1.2;
     double brightness = 0.0;
     double terminalAspectRatio = 1.0;
-    int queueSize = 16;
-    int prebufferFrames = 4;
-    bool staticPalette = false;
-    FitMode fit = COVER;
+    int queueSize = 16;      // frames buffered between playback stages
+    int prebufferFrames = 4; // frames encoded before playback starts
+    int workerThreads = 0;   // scale/encode workers, 0 = one per spare core
+    int maxConcurrentFetches = 8; // grid: downloads in flight at once
+    bool staticPalette = false;     // SIXEL: reuse one palette across frames
+    double sceneCutThreshold = 0.3; // histogram distance (0-1) that rebuilds it
+    FitMode fit = CONTAIN; // how aspectRatio fits the source to width x height
     bool fastResize = false; // Use INTER_NEAREST for video pre-scaling
-    SixelQuality sixelQuality = HIGH; // Add this line
+    SixelQuality sixelQuality = HIGH; // libsixel quantizer only; NATIVE ignores it
+    SixelEncoder sixelEncoder = LIBSIXEL; // NATIVE: parallel band encoder
+    Quantizer quantizer = MEDIAN_CUT; // palette builder for quantizeImage
     // Throughput controls
     double targetFps =
         0.0; // 0 = follow source FPS; otherwise downsample to this
@@ -42,14 +205,44 @@ public:
     double minScaleFactor = 0.80; // 80% of computed size
     double maxScaleFactor = 1.00; // up to full size
     double scaleStep = 0.05;      // adjust step per window
+    // Called from the playback writer thread on every quality change
+    std::function<void(const QualityEvent &)> onQualityChange;
+    // ULTRA_FAST video: redraw only cells that changed since the last frame
+    bool deltaFrames = false;
+    int deltaThreshold = 0; // max per-channel change still treated as unchanged
+    // Video: play the audio track through ffplay and pace frames by its
+    // clock. A URL's audio is a second fetch of the clip.
+    bool playAudio = true;
     // Hardware-accelerated decode and tiled updates
     bool hwAccelPipe = false;     // use ffmpeg pipe with -hwaccel auto
     bool tileUpdates = false;     // send only changed tiles each frame
     int tileWidth = 128;          // tile width in pixels
     int tileHeight = 64;          // tile height in pixels
     double tileDiffThreshold = 6.0; // average abs diff per channel to trigger update
+    // Also the keyframe interval of ULTRA_FAST delta transcodes
+    int tileRefreshInterval = 120;  // frames between full repaints, 0 = never
+    // GIF looping: later loops replay the first one's encoded frames
+    int gifLoops = 1;                     // times to play, 0 = forever
+    std::size_t gifCacheBytes = 64 << 20; // encoded frames kept for replay
+    // URL images: reuse downloads and rendered output across calls
+    std::shared_ptr<RenderCache> cache;
+    // Per-stage timing histograms for playback, read with stats()
+    bool collectStats = false;
+    std::string statsFile;      // also append JSON lines here while playing
+    double statsInterval = 1.0; // seconds between JSON lines
+    // Terminal output: frames are written whole by a writer thread
+    bool synchronizedUpdates = true; // default sink: DEC mode 2026 markers
+    int outputBuffers = 2; // playback frames written or queued at once (2-3)
+    std::shared_ptr<OutputSink> sink; // null = stdout
   };
 
+  Sakura();
+
+  // Stage timings of the running or most recent playback that had
+  // collectStats set. Safe to call from any thread while it plays.
+  PlaybackStats stats() const;
+  static const char *stageName(Stage stage) noexcept;
+
   bool renderFromUrl(std::string_view url, const RenderOptions &options) const;
   bool renderFromUrl(std::string_view url) const;
   bool renderFromMat(const cv::Mat &img, const RenderOptions &options) const;
@@ -64,26 +257,71 @@ public:
   std::vector<std::string>
   renderImageToLines(const cv::Mat &img, const RenderOptions &options) const;
 
+  // Renders every input (image path, URL, or directory of images) with
+  // options into a file in outputDirectory named after it (.six for SIXEL,
+  // .ans otherwise), on `threads` workers (0 = one per core) that steal
+  // work from each other. Each worker holds one image at a time.
+  BatchReport renderBatch(const std::vector<std::string> &inputs,
+                          const std::string &outputDirectory,
+                          const RenderOptions &options, int threads = 0) const;
+
+  // Pre-rendered playback: transcodeVideo runs the render pipeline once for
+  // the mode (ULTRA_FAST or SIXEL) and size in options and stores the frames
+  // in a .sakura container; playTranscoded writes them from a memory map,
+  // with the source's audio when it is still there. loops = 0 repeats
+  // forever.
+  bool transcodeVideo(std::string_view videoPath, std::string_view outputPath,
+                      const RenderOptions &options) const;
+  bool playTranscoded(std::string_view path, const RenderOptions &options,
+                      int loops = 1) const;
+
 private:
+  friend class SakuraBench; // sakura_bench.cpp times the private kernels
+  struct SixelPalette;
+  struct Telemetry;
+
+  std::shared_ptr<Telemetry> telemetry_;
+
   static const std::string ASCII_CHARS_SIMPLE;
   static const std::string ASCII_CHARS_DETAILED;
   static const std::string ASCII_CHARS_BLOCKS;
 
   const std::string &getCharSet(CharStyle style) const noexcept;
   static std::pair<int, int> getTerminalSize();
-  std::vector<std::string> renderExact(const cv::Mat &resized,
-                                       int terminal_height) const;
-  std::vector<std::string> renderAsciiColor(const cv::Mat &resized) const;
-  std::vector<std::string> renderAsciiGrayscale(const cv::Mat &resized,
-                                                std::string_view charSet,
-                                                DitherMode dither) const;
-  std::string renderSixel(const cv::Mat &img, int paletteSize = 16, int output_width = 0, int output_height = 0, SixelQuality quality = HIGH) const;
-  std::string renderVideoUltraFast(const cv::Mat &frame) const; // New ultra-fast method
+  static std::pair<int, int> getTerminalCellSize(); // pixels per cell
+  // The cell renderers append the whole frame, a newline after each row,
+  // to `output`; callers reuse the buffer across frames.
+  void renderExact(const cv::Mat &resized, int terminal_height,
+                   std::string &output) const;
+  void renderAsciiColor(const cv::Mat &resized, std::string &output) const;
+  void renderAsciiGrayscale(const cv::Mat &resized, std::string_view charSet,
+                            DitherMode dither, std::string &output) const;
+  std::string renderSixel(const cv::Mat &img, int paletteSize = 16,
+                          int output_width = 0, int output_height = 0,
+                          SixelQuality quality = HIGH,
+                          SixelPalette *palette = nullptr,
+                          SixelEncoder encoder = LIBSIXEL,
+                          Quantizer quantizer = MEDIAN_CUT) const;
+  bool renderSixel(const cv::Mat &img, std::string &output, int paletteSize,
+                   int output_width, int output_height, SixelQuality quality,
+                   SixelPalette *palette, SixelEncoder encoder,
+                   Quantizer quantizer) const;
+  void renderVideoUltraFast(const cv::Mat &frame, std::string &output) const;
   cv::Mat quantizeImage(const cv::Mat &inputImg, int numColors,
-                        cv::Mat &palette) const;
+                        cv::Mat &palette, Quantizer method = MEDIAN_CUT) const;
+  bool renderToBuffer(const cv::Mat &img, const RenderOptions &options,
+                      std::string &output) const;
+  bool playVideo(cv::VideoCapture &cap, std::string_view videoPath,
+                 const RenderOptions &options) const;
   bool preprocessAndResize(const cv::Mat &img, const RenderOptions &options,
                            cv::Mat &resized, int &target_width,
                            int &target_height) const;
+  // The resize + colour-adjust stage shared by every mode and playback loop.
+  // lut comes from the options' contrast/brightness, empty for none;
+  // scratch is reused between frames.
+  void scaleAndAdjust(const cv::Mat &img, cv::Size size, int interpolation,
+                      const cv::Mat &lut, cv::Mat &dst, cv::Mat &scratch,
+                      Telemetry *telemetry = nullptr) const;
 };
 
 #endif // SAKURA_HPP
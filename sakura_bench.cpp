@@ -0,0 +1,365 @@
+// Microbenchmarks for the render kernels. Runs every kernel over
+// deterministic synthetic frames (and optional fixture images) at common
+// terminal sizes and prints ns, output bytes and heap allocations per frame
+// as JSON, so hosts and builds can be compared without a terminal attached.
+#include "sakura.hpp"
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <getopt.h>
+#include <iostream>
+#include <new>
+#include <opencv2/opencv.hpp>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// Allocations made through operator new, from any thread. OpenCV buffers
+// (cv::fastMalloc) and libsixel's internals use malloc directly and are not
+// counted.
+static std::atomic<std::size_t> g_allocations{0};
+
+void *operator new(std::size_t size) {
+  g_allocations.fetch_add(1, std::memory_order_relaxed);
+  if (void *p = std::malloc(size == 0 ? 1 : size))
+    return p;
+  throw std::bad_alloc();
+}
+void operator delete(void *p) noexcept { std::free(p); }
+void operator delete(void *p, std::size_t) noexcept { std::free(p); }
+
+// Reaches the private kernels; Sakura befriends it.
+class SakuraBench {
+public:
+  using Kernel = std::function<std::size_t()>; // returns output bytes
+
+  struct Case {
+    std::string kernel;
+    std::string params;
+    Kernel run;
+  };
+
+  // Cases for one source frame at one terminal size (cols x rows cells).
+  static std::vector<Case> cases(const Sakura &sakura, const cv::Mat &source,
+                                 cv::Size terminal) {
+    // Inputs are prepared once, outside the timed region.
+    const cv::Size cells(terminal.width, terminal.height);
+    const cv::Size half_blocks(terminal.width, terminal.height * 2);
+    const cv::Size pixels(terminal.width * 10, terminal.height * 20);
+    cv::Mat cell_frame, half_block_frame, pixel_frame;
+    cv::resize(source, cell_frame, cells, 0, 0, cv::INTER_AREA);
+    cv::resize(source, half_block_frame, half_blocks, 0, 0, cv::INTER_AREA);
+    cv::resize(source, pixel_frame, pixels, 0, 0, cv::INTER_AREA);
+
+    std::vector<Case> all;
+    all.push_back({"preprocessAndResize", "mode=EXACT", [=, &sakura] {
+                     Sakura::RenderOptions options;
+                     options.mode = Sakura::EXACT;
+                     options.width = terminal.width;
+                     options.height = terminal.height;
+                     options.aspectRatio = false;
+                     cv::Mat resized;
+                     int width = 0, height = 0;
+                     sakura.preprocessAndResize(source, options, resized, width,
+                                                height);
+                     return resized.total() * resized.elemSize();
+                   }});
+    // End to end through the public API, into a buffer instead of a tty.
+    auto sink = std::make_shared<Sakura::BufferSink>();
+    all.push_back({"renderFromMat", "mode=EXACT sink=buffer", [=, &sakura] {
+                     Sakura::RenderOptions options;
+                     options.mode = Sakura::EXACT;
+                     options.width = terminal.width;
+                     options.height = terminal.height;
+                     options.aspectRatio = false;
+                     options.sink = sink;
+                     sakura.renderFromMat(source, options);
+                     return sink->take().size();
+                   }});
+    // Cell renderers append into one reused frame buffer, as in playback.
+    auto frame_output = std::make_shared<std::string>();
+    all.push_back({"renderExact", "", [=, &sakura] {
+                     frame_output->clear();
+                     sakura.renderExact(half_block_frame, terminal.height,
+                                        *frame_output);
+                     return frame_output->size();
+                   }});
+    all.push_back({"renderAsciiColor", "", [=, &sakura] {
+                     frame_output->clear();
+                     sakura.renderAsciiColor(cell_frame, *frame_output);
+                     return frame_output->size();
+                   }});
+    const std::pair<Sakura::DitherMode, const char *> dithers[] = {
+        {Sakura::NONE, "dither=NONE"},
+        {Sakura::FLOYD_STEINBERG, "dither=FLOYD_STEINBERG"},
+        {Sakura::FLOYD_STEINBERG_SERPENTINE,
+         "dither=FLOYD_STEINBERG_SERPENTINE"},
+        {Sakura::BAYER, "dither=BAYER"}};
+    for (const auto &entry : dithers) {
+      const Sakura::DitherMode dither = entry.first;
+      all.push_back({"renderAsciiGrayscale", entry.second, [=, &sakura] {
+                       frame_output->clear();
+                       sakura.renderAsciiGrayscale(cell_frame,
+                                                   Sakura::ASCII_CHARS_DETAILED,
+                                                   dither, *frame_output);
+                       return frame_output->size();
+                     }});
+    }
+    all.push_back({"renderAsciiGrayscale", "style=BLOCKS", [=, &sakura] {
+                     frame_output->clear();
+                     sakura.renderAsciiGrayscale(cell_frame,
+                                                 Sakura::ASCII_CHARS_BLOCKS,
+                                                 Sakura::NONE, *frame_output);
+                     return frame_output->size();
+                   }});
+    // The caller-owned buffer is reused, as in playback.
+    auto ultra_fast_output = std::make_shared<std::string>();
+    all.push_back({"renderVideoUltraFast", "", [=, &sakura] {
+                     ultra_fast_output->clear();
+                     sakura.renderVideoUltraFast(half_block_frame,
+                                                 *ultra_fast_output);
+                     return ultra_fast_output->size();
+                   }});
+    for (int palette : {16, 64, 256}) {
+      for (Sakura::SixelQuality quality : {Sakura::LOW, Sakura::HIGH}) {
+        std::string params = "encoder=LIBSIXEL palette=" +
+                             std::to_string(palette) + " quality=" +
+                             (quality == Sakura::LOW ? "LOW" : "HIGH");
+        all.push_back({"renderSixel", params, [=, &sakura] {
+                         return sakura
+                             .renderSixel(pixel_frame, palette, pixels.width,
+                                          pixels.height, quality)
+                             .size();
+                       }});
+      }
+      all.push_back(
+          {"renderSixel", "encoder=NATIVE palette=" + std::to_string(palette),
+           [=, &sakura] {
+             return sakura
+                 .renderSixel(pixel_frame, palette, pixels.width,
+                              pixels.height, Sakura::HIGH, nullptr,
+                              Sakura::NATIVE)
+                 .size();
+           }});
+    }
+    const std::pair<Sakura::Quantizer, const char *> quantizers[] = {
+        {Sakura::MEDIAN_CUT, "quantizer=MEDIAN_CUT"},
+        {Sakura::OCTREE, "quantizer=OCTREE"}};
+    for (const auto &entry : quantizers) {
+      const Sakura::Quantizer quantizer = entry.first;
+      all.push_back({"quantizeImage", std::string(entry.second) + " colors=256",
+                     [=, &sakura] {
+                       cv::Mat palette;
+                       const cv::Mat indices = sakura.quantizeImage(
+                           pixel_frame, 256, palette, quantizer);
+                       return indices.total() * indices.elemSize();
+                     }});
+    }
+    return all;
+  }
+};
+
+struct Measurement {
+  double ns_per_frame = 0.0;
+  double bytes_per_frame = 0.0;
+  double allocations_per_frame = 0.0;
+  long long iterations = 0;
+};
+
+// One warm-up call, then repeated calls until min_time has passed (and at
+// least three were made).
+Measurement measure(const SakuraBench::Kernel &kernel,
+                    std::chrono::milliseconds min_time) {
+  kernel();
+  Measurement m;
+  std::size_t bytes = 0;
+  const std::size_t allocations_before = g_allocations.load();
+  const auto start = std::chrono::steady_clock::now();
+  auto elapsed = std::chrono::steady_clock::duration::zero();
+  while (m.iterations < 3 || elapsed < min_time) {
+    bytes += kernel();
+    ++m.iterations;
+    elapsed = std::chrono::steady_clock::now() - start;
+  }
+  const double n = static_cast<double>(m.iterations);
+  m.ns_per_frame =
+      std::chrono::duration<double, std::nano>(elapsed).count() / n;
+  m.bytes_per_frame = static_cast<double>(bytes) / n;
+  m.allocations_per_frame =
+      static_cast<double>(g_allocations.load() - allocations_before) / n;
+  return m;
+}
+
+// Gradient, diagonal waves and seeded noise: smooth areas, edges and
+// texture, identical on every run.
+cv::Mat syntheticFrame(cv::Size size) {
+  cv::Mat frame(size, CV_8UC3);
+  for (int y = 0; y < size.height; ++y) {
+    cv::Vec3b *row = frame.ptr<cv::Vec3b>(y);
+    for (int x = 0; x < size.width; ++x) {
+      row[x] = cv::Vec3b(
+          static_cast<uchar>(x * 255 / size.width),
+          static_cast<uchar>(y * 255 / size.height),
+          static_cast<uchar>(128 + 127 * std::sin((x + y) / 37.0)));
+    }
+  }
+  cv::Mat noise(size, CV_8UC3);
+  cv::RNG rng(0x5a4b);
+  rng.fill(noise, cv::RNG::UNIFORM, 0, 24);
+  cv::add(frame, noise, frame);
+  return frame;
+}
+
+// Control characters (U+0000-U+001F) must be escaped in JSON strings.
+std::string jsonString(const std::string &text) {
+  static constexpr char hex[] = "0123456789abcdef";
+  std::string quoted = "\"";
+  for (char c : text) {
+    const auto byte = static_cast<unsigned char>(c);
+    if (byte < 0x20) {
+      quoted += "\\u00";
+      quoted += hex[byte >> 4];
+      quoted += hex[byte & 0xf];
+      continue;
+    }
+    if (c == '"' || c == '\\')
+      quoted += '\\';
+    quoted += c;
+  }
+  quoted += '"';
+  return quoted;
+}
+
+bool parseSize(const std::string &text, cv::Size &size) {
+  const std::size_t x = text.find('x');
+  if (x == std::string::npos)
+    return false;
+  size.width = std::atoi(text.substr(0, x).c_str());
+  size.height = std::atoi(text.substr(x + 1).c_str());
+  return size.width > 0 && size.height > 0;
+}
+
+int main(int argc, char **argv) {
+  static struct option long_options[] = {
+      {"help", no_argument, 0, 'h'},
+      {"fixture", required_argument, 0, 'f'},
+      {"size", required_argument, 0, 's'},
+      {"filter", required_argument, 0, 'k'},
+      {"min-time", required_argument, 0, 't'},
+      {"threads", required_argument, 0, 'j'},
+      {"output", required_argument, 0, 'o'},
+      {0, 0, 0, 0}};
+
+  std::vector<std::pair<std::string, cv::Mat>> frames;
+  std::vector<cv::Size> terminals;
+  std::string filter, output_path;
+  int min_time_ms = 200;
+
+  int opt;
+  int option_index = 0;
+  while ((opt = getopt_long(argc, argv, "hf:s:k:t:j:o:", long_options,
+                            &option_index)) != -1) {
+    switch (opt) {
+    case 'h':
+      std::cout
+          << "Usage: sakura_bench [options]\n"
+          << "Options:\n"
+          << "  -h, --help              Show help message\n"
+          << "  -f, --fixture <path>    Also run on this image (repeatable)\n"
+          << "  -s, --size <COLSxROWS>  Terminal size (repeatable; default\n"
+          << "                          80x24, 120x40, 200x60, 400x120)\n"
+          << "  -k, --filter <text>     Only kernels whose name contains it\n"
+          << "  -t, --min-time <ms>     Time per case (default 200)\n"
+          << "  -j, --threads <n>       OpenCV worker threads\n"
+          << "  -o, --output <path>     Write JSON here instead of stdout\n";
+      return 0;
+    case 'f': {
+      cv::Mat fixture = cv::imread(optarg, cv::IMREAD_COLOR);
+      if (fixture.empty()) {
+        std::cerr << "Failed to load fixture: " << optarg << std::endl;
+        return 1;
+      }
+      frames.emplace_back(optarg, fixture);
+      break;
+    }
+    case 's': {
+      cv::Size size;
+      if (!parseSize(optarg, size)) {
+        std::cerr << "Invalid size: " << optarg << std::endl;
+        return 1;
+      }
+      terminals.push_back(size);
+      break;
+    }
+    case 'k':
+      filter = optarg;
+      break;
+    case 't':
+      min_time_ms = std::max(1, std::atoi(optarg));
+      break;
+    case 'j':
+      cv::setNumThreads(std::atoi(optarg));
+      break;
+    case 'o':
+      output_path = optarg;
+      break;
+    default:
+      return 1;
+    }
+  }
+
+  frames.insert(frames.begin(), {"synthetic", syntheticFrame({1920, 1080})});
+  if (terminals.empty()) {
+    terminals = {{80, 24}, {120, 40}, {200, 60}, {400, 120}};
+  }
+
+  Sakura sakura;
+  std::ostringstream json;
+  json << "{\n  \"host\": {\"opencv\": " << jsonString(cv::getVersionString())
+       << ", \"cores\": " << std::thread::hardware_concurrency()
+       << ", \"opencv_threads\": " << cv::getNumThreads() << "},\n"
+       << "  \"results\": [";
+  bool first = true;
+  for (const auto &[frame_name, source] : frames) {
+    for (const cv::Size &terminal : terminals) {
+      const std::string size = std::to_string(terminal.width) + "x" +
+                               std::to_string(terminal.height);
+      for (const auto &bench : SakuraBench::cases(sakura, source, terminal)) {
+        if (!filter.empty() && bench.kernel.find(filter) == std::string::npos)
+          continue;
+        std::cerr << bench.kernel << " " << bench.params << " " << size << " "
+                  << frame_name << std::endl;
+        const Measurement m =
+            measure(bench.run, std::chrono::milliseconds(min_time_ms));
+        json << (first ? "\n" : ",\n") << "    {\"kernel\": "
+             << jsonString(bench.kernel)
+             << ", \"params\": " << jsonString(bench.params)
+             << ", \"frame\": " << jsonString(frame_name)
+             << ", \"terminal\": " << jsonString(size)
+             << ", \"ns_per_frame\": " << std::llround(m.ns_per_frame)
+             << ", \"bytes_per_frame\": " << std::llround(m.bytes_per_frame)
+             << ", \"allocations_per_frame\": " << m.allocations_per_frame
+             << ", \"iterations\": " << m.iterations << "}";
+        first = false;
+      }
+    }
+  }
+  json << "\n  ]\n}\n";
+
+  if (output_path.empty()) {
+    std::cout << json.str();
+  } else {
+    std::ofstream file(output_path);
+    file << json.str();
+    if (!file) {
+      std::cerr << "Failed to write " << output_path << std::endl;
+      return 1;
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,238 @@
+// Renders a grid from a local HTTP stand-in that answers each image after a
+// different delay, and checks that every cell lands in its own place
+// whatever order the downloads finish in, and that no more than
+// maxConcurrentFetches requests are ever in flight. Exits 0 on success, 1 on
+// failure and 77 when the test images cannot be encoded.
+#include "sakura.hpp"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <opencv2/opencv.hpp>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+constexpr int IMAGES = 6;
+constexpr int COLUMNS = 3;
+constexpr int MAX_FETCHES = 2;
+
+cv::Scalar cellColour(int i) { // BGR
+  return cv::Scalar(40 * i, 200 - 30 * i, 90 + 25 * i);
+}
+
+// The background escape the ASCII_COLOR renderer writes for cell i.
+std::string cellEscape(int i) {
+  const cv::Scalar colour = cellColour(i);
+  return "\033[48;2;" + std::to_string(static_cast<int>(colour[2])) + ";" +
+         std::to_string(static_cast<int>(colour[1])) + ";" +
+         std::to_string(static_cast<int>(colour[0])) + "m";
+}
+
+// Serves /<i>.png from `images`, each connection on its own thread, holding
+// the answer to image i for delays[i]. Counts the requests in flight.
+class StandInServer {
+public:
+  explicit StandInServer(std::vector<std::string> images)
+      : images_(std::move(images)) {
+    listener_ = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in address{};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t length = sizeof(address);
+    if (listener_ < 0 ||
+        bind(listener_, reinterpret_cast<sockaddr *>(&address), length) != 0 ||
+        listen(listener_, 16) != 0 ||
+        getsockname(listener_, reinterpret_cast<sockaddr *>(&address),
+                    &length) != 0) {
+      return;
+    }
+    port_ = ntohs(address.sin_port);
+    thread_ = std::thread([this] { accept_loop(); });
+  }
+
+  ~StandInServer() {
+    stop_ = true;
+    if (thread_.joinable())
+      thread_.join();
+    for (auto &client : clients_)
+      client.join();
+    if (listener_ >= 0)
+      close(listener_);
+  }
+
+  int port() const { return port_; }
+  int requests() const { return requests_; }
+  int maxInFlight() const { return max_in_flight_; }
+
+  void setDelays(std::vector<std::chrono::milliseconds> delays) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    delays_ = std::move(delays);
+  }
+
+private:
+  void accept_loop() {
+    while (!stop_) {
+      pollfd pending{listener_, POLLIN, 0};
+      if (poll(&pending, 1, 100) <= 0)
+        continue;
+      const int client = accept(listener_, nullptr, nullptr);
+      if (client >= 0)
+        clients_.emplace_back([this, client] { serve(client); });
+    }
+  }
+
+  void serve(int client) {
+    std::string request;
+    char buffer[1024];
+    while (request.find("\r\n\r\n") == std::string::npos) {
+      const ssize_t n = recv(client, buffer, sizeof(buffer), 0);
+      if (n <= 0)
+        break;
+      request.append(buffer, static_cast<std::size_t>(n));
+    }
+    ++requests_;
+    const int now = ++in_flight_;
+    int seen = max_in_flight_;
+    while (now > seen && !max_in_flight_.compare_exchange_weak(seen, now)) {
+    }
+
+    // "GET /3.png HTTP/1.1"
+    const std::size_t slash = request.find('/');
+    const int index =
+        slash == std::string::npos ? -1 : std::atoi(request.c_str() + slash + 1);
+    std::string response;
+    if (index >= 0 && index < static_cast<int>(images_.size())) {
+      std::chrono::milliseconds delay{0};
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (index < static_cast<int>(delays_.size()))
+          delay = delays_[index];
+      }
+      std::this_thread::sleep_for(delay);
+      response = "HTTP/1.1 200 OK\r\nContent-Type: image/png\r\n"
+                 "Content-Length: " +
+                 std::to_string(images_[index].size()) +
+                 "\r\nConnection: close\r\n\r\n" + images_[index];
+    } else {
+      response = "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\n"
+                 "Connection: close\r\n\r\n";
+    }
+    send(client, response.data(), response.size(), MSG_NOSIGNAL);
+    --in_flight_;
+    close(client);
+  }
+
+  std::vector<std::string> images_;
+  std::mutex mutex_;
+  std::vector<std::chrono::milliseconds> delays_;
+  int listener_ = -1;
+  int port_ = 0;
+  std::thread thread_;
+  std::vector<std::thread> clients_; // only touched by the accept thread
+  std::atomic<bool> stop_{false};
+  std::atomic<int> requests_{0};
+  std::atomic<int> in_flight_{0};
+  std::atomic<int> max_in_flight_{0};
+};
+
+// Whether, on the first line of each grid row, the cells' colours appear
+// left to right in URL order.
+bool cellsInPlace(const std::string &grid) {
+  std::vector<std::string> lines;
+  for (std::size_t begin = 0; begin < grid.size();) {
+    const std::size_t end = grid.find('\n', begin);
+    lines.push_back(grid.substr(begin, end - begin));
+    if (end == std::string::npos)
+      break;
+    begin = end + 1;
+  }
+  const int rows = (IMAGES + COLUMNS - 1) / COLUMNS;
+  if (lines.empty() || lines.size() % rows != 0)
+    return false;
+  const std::size_t cell_lines = lines.size() / rows;
+  for (int r = 0; r < rows; ++r) {
+    const std::string &line = lines[r * cell_lines];
+    std::size_t previous = 0;
+    for (int c = 0; c < COLUMNS && r * COLUMNS + c < IMAGES; ++c) {
+      const std::size_t at = line.find(cellEscape(r * COLUMNS + c));
+      if (at == std::string::npos || (c > 0 && at <= previous))
+        return false;
+      previous = at;
+    }
+  }
+  return true;
+}
+} // namespace
+
+int main() {
+  std::vector<std::string> images;
+  for (int i = 0; i < IMAGES; ++i) {
+    const cv::Mat image(24, 32, CV_8UC3, cellColour(i));
+    std::vector<uchar> png;
+    if (!cv::imencode(".png", image, png)) {
+      std::cerr << "SKIP: cannot encode PNG test images" << std::endl;
+      return 77;
+    }
+    images.emplace_back(png.begin(), png.end());
+  }
+
+  StandInServer server(images);
+  if (server.port() == 0) {
+    std::cerr << "FAIL: stand-in server did not start" << std::endl;
+    return 1;
+  }
+  std::vector<std::string> urls;
+  for (int i = 0; i < IMAGES; ++i) {
+    urls.push_back("http://127.0.0.1:" + std::to_string(server.port()) + "/" +
+                   std::to_string(i) + ".png");
+  }
+
+  Sakura sakura;
+  const auto render = [&](std::vector<std::chrono::milliseconds> delays,
+                          std::string &grid) {
+    server.setDelays(std::move(delays));
+    auto sink = std::make_shared<Sakura::BufferSink>();
+    Sakura::RenderOptions options;
+    options.mode = Sakura::ASCII_COLOR;
+    options.maxConcurrentFetches = MAX_FETCHES;
+    options.sink = sink;
+    const bool ok = sakura.renderGridFromUrls(urls, COLUMNS, options);
+    grid = sink->take();
+    return ok;
+  };
+
+  // Early cells answer last in the first run and first in the second.
+  std::vector<std::chrono::milliseconds> slow_first, fast_first;
+  for (int i = 0; i < IMAGES; ++i) {
+    slow_first.emplace_back(40 * (IMAGES - i));
+    fast_first.emplace_back(40 * (i + 1));
+  }
+  std::string first, second;
+  const bool rendered = render(slow_first, first) && render(fast_first, second);
+
+  bool ok = true;
+  const auto check = [&ok](bool condition, const char *what) {
+    std::cerr << (condition ? "ok   " : "FAIL ") << what << std::endl;
+    ok = ok && condition;
+  };
+  check(rendered, "grids rendered");
+  check(server.requests() == 2 * IMAGES, "each image requested once per grid");
+  check(cellsInPlace(first), "cells in URL order when early cells finish last");
+  check(!first.empty() && first == second,
+        "output identical whatever order downloads finish in");
+  check(server.maxInFlight() <= MAX_FETCHES,
+        "no more than maxConcurrentFetches requests in flight");
+  check(server.maxInFlight() == MAX_FETCHES, "fetches overlapped");
+  return ok ? 0 : 1;
+}
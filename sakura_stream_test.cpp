@@ -0,0 +1,189 @@
+// Streams a generated clip from a local HTTP stand-in through
+// renderVideoFromUrl and checks that the clip is requested once and, when
+// OpenCV can read http itself, that the first frame is drawn before the
+// download has finished. Exits 0 on success, 1 on failure and 77 when the
+// clip cannot be generated.
+#include "sakura.hpp"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <memory>
+#include <opencv2/opencv.hpp>
+#include <opencv2/videoio/registry.hpp>
+#include <optional>
+#include <string>
+#include <thread>
+
+namespace {
+using Clock = std::chrono::steady_clock;
+
+std::string makeClip(const std::filesystem::path &path) {
+  cv::VideoWriter writer(path.string(),
+                         cv::VideoWriter::fourcc('M', 'J', 'P', 'G'), 24.0,
+                         cv::Size(64, 48));
+  if (!writer.isOpened())
+    return {};
+  for (int i = 0; i < 48; ++i) {
+    cv::Mat frame(48, 64, CV_8UC3, cv::Scalar(i * 5, 128, 255 - i * 5));
+    cv::circle(frame, cv::Point(i + 8, 24), 6, cv::Scalar(255, 255, 255), -1);
+    writer.write(frame);
+  }
+  writer.release();
+  std::ifstream file(path, std::ios::binary);
+  return std::string(std::istreambuf_iterator<char>(file), {});
+}
+
+// Serves `body` to every request, without range support, trickled out over
+// about `duration` so a progressive reader sees it arrive.
+class StandInServer {
+public:
+  StandInServer(std::string body, std::chrono::milliseconds duration)
+      : body_(std::move(body)), duration_(duration) {
+    listener_ = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in address{};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t length = sizeof(address);
+    if (listener_ < 0 ||
+        bind(listener_, reinterpret_cast<sockaddr *>(&address), length) != 0 ||
+        listen(listener_, 4) != 0 ||
+        getsockname(listener_, reinterpret_cast<sockaddr *>(&address),
+                    &length) != 0) {
+      return;
+    }
+    port_ = ntohs(address.sin_port);
+    thread_ = std::thread([this] { serve(); });
+  }
+
+  ~StandInServer() {
+    stop_ = true;
+    if (thread_.joinable())
+      thread_.join();
+    if (listener_ >= 0)
+      close(listener_);
+  }
+
+  int port() const { return port_; }
+  int requests() const { return requests_; }
+  std::optional<Clock::time_point> finished() const {
+    if (!done_)
+      return std::nullopt;
+    return finished_;
+  }
+
+private:
+  void serve() {
+    while (!stop_) {
+      pollfd pending{listener_, POLLIN, 0};
+      if (poll(&pending, 1, 100) <= 0)
+        continue;
+      const int client = accept(listener_, nullptr, nullptr);
+      if (client < 0)
+        continue;
+      std::string request;
+      char buffer[1024];
+      while (request.find("\r\n\r\n") == std::string::npos) {
+        const ssize_t n = recv(client, buffer, sizeof(buffer), 0);
+        if (n <= 0)
+          break;
+        request.append(buffer, static_cast<std::size_t>(n));
+      }
+      ++requests_;
+      const std::string header =
+          "HTTP/1.1 200 OK\r\nContent-Type: video/x-msvideo\r\n"
+          "Content-Length: " +
+          std::to_string(body_.size()) + "\r\nConnection: close\r\n\r\n";
+      send(client, header.data(), header.size(), MSG_NOSIGNAL);
+      constexpr std::size_t chunk = 2048;
+      const auto pause = duration_ / ((body_.size() + chunk - 1) / chunk);
+      for (std::size_t sent = 0; sent < body_.size() && !stop_;
+           sent += chunk) {
+        if (sent > 0)
+          std::this_thread::sleep_for(pause);
+        const std::size_t n = std::min(chunk, body_.size() - sent);
+        if (send(client, body_.data() + sent, n, MSG_NOSIGNAL) < 0)
+          break;
+      }
+      finished_ = Clock::now();
+      done_ = true;
+      close(client);
+    }
+  }
+
+  std::string body_;
+  std::chrono::milliseconds duration_;
+  int listener_ = -1;
+  int port_ = 0;
+  std::thread thread_;
+  std::atomic<bool> stop_{false};
+  std::atomic<int> requests_{0};
+  std::atomic<bool> done_{false};
+  Clock::time_point finished_;
+};
+} // namespace
+
+int main() {
+  const std::filesystem::path clip_path =
+      std::filesystem::temp_directory_path() /
+      ("sakura_stream_test_" + std::to_string(getpid()) + ".avi");
+  const std::string clip = makeClip(clip_path);
+  std::filesystem::remove(clip_path);
+  if (clip.empty()) {
+    std::cerr << "SKIP: cannot write an MJPG test clip" << std::endl;
+    return 77;
+  }
+
+  StandInServer server(clip, std::chrono::milliseconds(3000));
+  if (server.port() == 0) {
+    std::cerr << "FAIL: stand-in server did not start" << std::endl;
+    return 1;
+  }
+
+  std::atomic<int> frames{0};
+  std::optional<Clock::time_point> first_frame;
+  Sakura::RenderOptions options;
+  options.mode = Sakura::ULTRA_FAST;
+  options.width = 32;
+  options.height = 12;
+  options.playAudio = false; // ffplay would fetch the clip a second time
+  options.sink = std::make_shared<Sakura::CallbackSink>(
+      [&](std::string_view, const Sakura::FrameInfo &info) {
+        if (!info.control) {
+          if (!first_frame)
+            first_frame = Clock::now();
+          ++frames;
+        }
+        return true;
+      });
+
+  Sakura sakura;
+  const std::string url =
+      "http://127.0.0.1:" + std::to_string(server.port()) + "/clip.avi";
+  const bool played = sakura.renderVideoFromUrl(url, options);
+
+  bool ok = true;
+  const auto check = [&ok](bool condition, const char *what) {
+    std::cerr << (condition ? "ok   " : "FAIL ") << what << std::endl;
+    ok = ok && condition;
+  };
+  check(played, "playback succeeded");
+  check(frames > 0, "frames reached the sink");
+  check(server.requests() == 1, "clip was requested exactly once");
+  if (cv::videoio_registry::hasBackend(cv::CAP_FFMPEG)) {
+    const auto finished = server.finished();
+    check(first_frame && (!finished || *first_frame < *finished),
+          "first frame drawn before the download finished");
+  }
+  return ok ? 0 : 1;
+}